@@ -29,6 +29,14 @@ IF (DEFINED ZYPP_PREFIX)
     NO_SYSTEM_ENVIRONMENT_PATH
     NO_CMAKE_SYSTEM_PATH
   )
+  FIND_LIBRARY(ZYPP_SOLV_LIBRARY NAMES solv
+    PATHS
+    ${ZYPP_PREFIX}/lib
+    ${ZYPP_PREFIX}/lib64
+    NO_DEFAULT_PATH
+    NO_SYSTEM_ENVIRONMENT_PATH
+    NO_CMAKE_SYSTEM_PATH
+  )
 ELSE (DEFINED ZYPP_PREFIX)
   FIND_PATH(ZYPP_INCLUDE_DIR zypp/ZYpp.h
     /usr/include
@@ -39,13 +47,19 @@ ELSE (DEFINED ZYPP_PREFIX)
     /usr/lib
     /usr/local/lib
   )
+  # We poke libsolv directly for pool snapshots
+  FIND_LIBRARY(ZYPP_SOLV_LIBRARY NAMES solv
+    PATHS
+    /usr/lib
+    /usr/local/lib
+  )
 ENDIF (DEFINED ZYPP_PREFIX)
 
-if(ZYPP_INCLUDE_DIR AND ZYPP_LIBRARY)
+if(ZYPP_INCLUDE_DIR AND ZYPP_LIBRARY AND ZYPP_SOLV_LIBRARY)
    MESSAGE( STATUS "ZYpp found: includes in ${ZYPP_INCLUDE_DIR}, library in ${ZYPP_LIBRARY}")
    set(ZYPP_FOUND TRUE)
-else(ZYPP_INCLUDE_DIR AND ZYPP_LIBRARY)
+else(ZYPP_INCLUDE_DIR AND ZYPP_LIBRARY AND ZYPP_SOLV_LIBRARY)
    MESSAGE( FATAL_ERROR "ZYpp not found")
-endif(ZYPP_INCLUDE_DIR AND ZYPP_LIBRARY)
+endif(ZYPP_INCLUDE_DIR AND ZYPP_LIBRARY AND ZYPP_SOLV_LIBRARY)
 
-MARK_AS_ADVANCED(ZYPP_INCLUDE_DIR ZYPP_LIBRARY)
+MARK_AS_ADVANCED(ZYPP_INCLUDE_DIR ZYPP_LIBRARY ZYPP_SOLV_LIBRARY)
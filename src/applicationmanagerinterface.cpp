@@ -91,6 +91,12 @@ void ApplicationManagerInterface::initImpl()
         qWarning() << "Could not connect to the report progress interface! Transaction Progress won't be available." << QDBusConnection::systemBus().lastError();
     }
 
+    // The backend resolves updates on its own after every refresh, and tells us when the list changes.
+    if (!QDBusConnection::systemBus().connect(BACKEND_SERVICE, BACKEND_PATH, BACKEND_INTERFACE,
+                                              QStringLiteral("applicationUpdatesChanged"), this, SLOT(onApplicationUpdatesChanged(QByteArray)))) {
+        qWarning() << "Could not connect to the backend's update notifications! Updates will show up only when checked for." << QDBusConnection::systemBus().lastError();
+    }
+
     // On startup, we want to ask the backend if there's something ready for us. At ease, tho.
     connect(this, &Hemera::AsyncInitObject::ready, this, &ApplicationManagerInterface::refreshUpdateList, Qt::QueuedConnection);
     connect(this, &Hemera::AsyncInitObject::ready, this, &ApplicationManagerInterface::refreshInstalledApplicationsList, Qt::QueuedConnection);
@@ -167,12 +173,21 @@ void ApplicationManagerInterface::onReportProgress(uint actionType, uint progres
     qDebug() << Q_FUNC_INFO << actionType << progress << rate;
 }
 
+void ApplicationManagerInterface::onApplicationUpdatesChanged(const QByteArray &applicationUpdates)
+{
+    if (applicationUpdates != m_applicationUpdates) {
+        m_applicationUpdates = applicationUpdates;
+        Q_EMIT applicationUpdatesChanged(m_applicationUpdates);
+    }
+}
+
 void ApplicationManagerInterface::checkForApplicationUpdates()
 {
-    HANDLE_DBUS_REPLY(createBackendCall(QStringLiteral("refreshRepositories")))
+    // One round trip: the backend refreshes and lists on the same pool.
+    HANDLE_DBUS_REPLY(createBackendCall(QStringLiteral("refreshRepositoriesAndListUpdates")))
 
     connect(watcher, &QDBusPendingCallWatcher::finished, [this, request, requestConnection] (QDBusPendingCallWatcher *call) {
-        QDBusPendingReply<void> reply = *call;
+        QDBusPendingReply<QByteArray> reply = *call;
 
         if (!reply.isError()) {
             // Good. Reset our counter.
@@ -187,8 +202,12 @@ void ApplicationManagerInterface::checkForApplicationUpdates()
         }
 
         if (!reply.isError()) {
-            // On a successful refresh, we also want to refresh the update list.
-            refreshUpdateList();
+            // The update list came along with the refresh.
+            QByteArray applicationUpdates = reply.value();
+            if (applicationUpdates != m_applicationUpdates) {
+                m_applicationUpdates = applicationUpdates;
+                Q_EMIT applicationUpdatesChanged(m_applicationUpdates);
+            }
         }
     });
 }
@@ -227,17 +246,18 @@ void ApplicationManagerInterface::refreshInstalledApplicationsList()
 
 void ApplicationManagerInterface::refreshUpdateList()
 {
-    QDBusPendingCall reply = QDBusConnection::systemBus().asyncCall(createBackendCall(QStringLiteral("listUpdates")));
+    QDBusPendingCall reply = QDBusConnection::systemBus().asyncCall(createBackendCall(QStringLiteral("listProvisionalUpdates")));
 
     connect(new QDBusPendingCallWatcher(reply, this), &QDBusPendingCallWatcher::finished, [this] (QDBusPendingCallWatcher *call) {
-        QDBusPendingReply<QByteArray, QByteArray> reply = *call;
+        QDBusPendingReply<QByteArray, QString> reply = *call;
         if (reply.isError()) {
             qWarning() << "Could not retrieve the update list!";
             m_applicationUpdates.clear();
             m_systemUpdate.clear();
         } else {
-            // Good. Reassign the variables.
-            QByteArray applicationUpdates = reply.argumentAt(0).toByteArray();
+            // Good. Reassign the variables. A provisional list gets replaced through applicationUpdatesChanged once verified.
+            QByteArray applicationUpdates = reply.argumentAt<0>();
+            qDebug() << "Got a" << reply.argumentAt<1>() << "update list.";
             if (applicationUpdates != m_applicationUpdates) {
                 m_applicationUpdates = applicationUpdates;
                 Q_EMIT applicationUpdatesChanged(m_applicationUpdates);
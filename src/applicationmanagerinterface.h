@@ -52,6 +52,7 @@ Q_SIGNALS:
 
 private Q_SLOTS:
     void onReportProgress(uint actionType, uint progress, uint rate);
+    void onApplicationUpdatesChanged(const QByteArray &applicationUpdates);
     void restartAutoCheckTimer();
 
 private:
@@ -58,10 +58,30 @@ void IncrementalUpdateOperation::startImpl()
         return;
     }
 
+    // Let the backend do all it can while the system is still read-only: the remount window is for rpm alone.
+    QDBusMessage prepareCall = createBackendCall(QStringLiteral("prepareSystemUpdate"), QVariantList() << packagePath);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(QDBusConnection::systemBus().asyncCall(prepareCall, callTimeout()), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, packagePath] (QDBusPendingCallWatcher *call) {
+        QDBusPendingReply<QByteArray> reply = *call;
+        call->deleteLater();
+
+        if (reply.isError()) {
+            qDebug() << "Could not prepare the update" << reply.error();
+            unmountPackage(packagePath);
+            setFinishedWithError(reply.error());
+            return;
+        }
+
+        remountAndUpdate(packagePath, reply.value());
+    });
+}
+
+void IncrementalUpdateOperation::remountAndUpdate(const QString &packagePath, const QByteArray &handle)
+{
     // Time to remount!
     Hemera::Operation *mountOp = new Gravity::ControlUnitOperation(QStringLiteral("gravity-remount-helper.service"), QString(),
                                                                    Gravity::ControlUnitOperation::Mode::StartMode, nullptr, this);
-    connect(mountOp, &Hemera::Operation::finished, this, [this, mountOp, packagePath] {
+    connect(mountOp, &Hemera::Operation::finished, this, [this, mountOp, packagePath, handle] {
         if (mountOp->isError()) {
             // Utterly failed.
             unmountPackage(packagePath);
@@ -83,24 +103,34 @@ void IncrementalUpdateOperation::startImpl()
                 }
             }
             Hemera::CompositeOperation *compositeOp = new Hemera::CompositeOperation(injections, this);
-            connect(compositeOp, &Hemera::Operation::finished, this, [this, packagePath] {
-                performIncrementalPackageUpdate(packagePath);
+            connect(compositeOp, &Hemera::Operation::finished, this, [this, packagePath, handle] {
+                performIncrementalPackageUpdate(packagePath, handle);
             });
             return;
         }
 
-        performIncrementalPackageUpdate(packagePath);
+        performIncrementalPackageUpdate(packagePath, handle);
     });
 }
 
-void IncrementalUpdateOperation::performIncrementalPackageUpdate(const QString &packagePath)
+void IncrementalUpdateOperation::performIncrementalPackageUpdate(const QString &packagePath, const QByteArray &handle)
 {
-    QDBusMessage updateSystemCall = createBackendCall(QStringLiteral("updateSystem"), QVariantList() << packagePath);
+    // Without a handle, the backend does it all in one go.
+    QDBusMessage updateSystemCall = handle.isEmpty() ? createBackendCall(QStringLiteral("updateSystem"), QVariantList() << packagePath)
+                                                     : createBackendCall(QStringLiteral("commitPreparedUpdate"), QVariantList() << handle);
     QDBusPendingCall reply = QDBusConnection::systemBus().asyncCall(updateSystemCall, callTimeout());
     QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(reply, this);
 
-    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, packagePath] (QDBusPendingCallWatcher *call) {
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, packagePath, handle] (QDBusPendingCallWatcher *call) {
         QDBusPendingReply<void> reply = *call;
+        if (reply.isError() && !handle.isEmpty() && reply.error().type() == QDBusError::InvalidArgs) {
+            // The backend lost our preparation, most likely it has been restarted meanwhile. Do it the slow way.
+            qWarning() << "Prepared update" << handle << "is gone, updating in one go.";
+            call->deleteLater();
+            performIncrementalPackageUpdate(packagePath, QByteArray());
+            return;
+        }
+
         if (!reply.isError()) {
             // Success! We need to update the appliance manifest before we remount.
             QSettings applianceData(QStringLiteral("/etc/hemera/appliance_manifest"), QSettings::IniFormat);
@@ -22,7 +22,8 @@ protected:
     virtual void startImpl() override final;
 
 private:
-    void performIncrementalPackageUpdate(const QString &packagePath);
+    void remountAndUpdate(const QString &packagePath, const QByteArray &handle);
+    void performIncrementalPackageUpdate(const QString &packagePath, const QByteArray &handle);
 
     Gravity::GalaxyManager *m_manager;
     QString m_updateOrbit;
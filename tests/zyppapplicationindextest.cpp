@@ -0,0 +1,169 @@
+#include "zyppapplicationindex.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+#include <QtTest/QtTest>
+
+#include <utime.h>
+
+// Changes reach the index through its watcher: the QTRY_ macros spin the event loop until they got there.
+class ApplicationIndexTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+
+    void scanServices();
+    void rescanOnAdd();
+    void rescanOnRemove();
+    void rescanOnEdit();
+    void snapshotsAreValues();
+    void directoryShowsUpLater();
+
+private:
+    QString servicePath(const QString &applicationId) const;
+    bool writeService(const QString &applicationId, time_t mtime = 0);
+    static QStringList applicationIds(const ApplicationIndex::Snapshot &snapshot);
+
+    QScopedPointer<QTemporaryDir> m_dir;
+};
+
+void ApplicationIndexTest::init()
+{
+    m_dir.reset(new QTemporaryDir);
+    QVERIFY(m_dir->isValid());
+}
+
+QString ApplicationIndexTest::servicePath(const QString &applicationId) const
+{
+    return m_dir->path() + QStringLiteral("/services/") + applicationId + QStringLiteral(".ha");
+}
+
+bool ApplicationIndexTest::writeService(const QString &applicationId, time_t mtime)
+{
+    QDir().mkpath(m_dir->path() + QStringLiteral("/services"));
+    QFile service(servicePath(applicationId));
+    if (!service.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        return false;
+    }
+    service.write("// service\n");
+    service.close();
+
+    if (mtime == 0) {
+        return true;
+    }
+
+    // Explicit, so that an edit shows in the fingerprint however coarse the file system's timestamps are.
+    struct utimbuf times;
+    times.actime = mtime;
+    times.modtime = mtime;
+    return ::utime(QFile::encodeName(service.fileName()).constData(), &times) == 0;
+}
+
+QStringList ApplicationIndexTest::applicationIds(const ApplicationIndex::Snapshot &snapshot)
+{
+    QStringList result;
+    for (const ApplicationIndex::Application &application : snapshot.applications()) {
+        result.append(application.applicationId);
+    }
+    result.sort();
+    return result;
+}
+
+void ApplicationIndexTest::scanServices()
+{
+    QVERIFY(writeService(QStringLiteral("com.ispirata.test")));
+    QVERIFY(QFile(m_dir->path() + QStringLiteral("/services/README")).open(QIODevice::WriteOnly));
+
+    ApplicationIndex index(m_dir->path() + QStringLiteral("/services"));
+    ApplicationIndex::Snapshot snapshot = index.snapshot();
+
+    QCOMPARE(snapshot.applications().size(), 1);
+    const ApplicationIndex::Application &application = snapshot.applications().first();
+    QCOMPARE(application.applicationId, QStringLiteral("com.ispirata.test"));
+    QCOMPARE(application.trimmedId, QStringLiteral("comispiratatest"));
+    QCOMPARE(application.packageName, QStringLiteral("ha-comispiratatest"));
+
+    QCOMPARE(snapshot.applicationIdForPackage(QStringLiteral("ha-comispiratatest")), QStringLiteral("com.ispirata.test"));
+    // Dots in the package name are fine as well.
+    QCOMPARE(snapshot.applicationIdForPackage(QStringLiteral("ha-com.ispirata.test")), QStringLiteral("com.ispirata.test"));
+    QVERIFY(snapshot.applicationIdForPackage(QStringLiteral("hemera-base")).isEmpty());
+    QVERIFY(snapshot.applicationIdForPackage(QStringLiteral("ha-com.ispirata.other")).isEmpty());
+
+    QVERIFY(!snapshot.fingerprint().isEmpty());
+}
+
+void ApplicationIndexTest::rescanOnAdd()
+{
+    QVERIFY(writeService(QStringLiteral("com.ispirata.first")));
+    ApplicationIndex index(m_dir->path() + QStringLiteral("/services"));
+    QCOMPARE(applicationIds(index.snapshot()), QStringList() << QStringLiteral("com.ispirata.first"));
+    QByteArray fingerprint = index.snapshot().fingerprint();
+
+    QVERIFY(writeService(QStringLiteral("com.ispirata.second")));
+    QTRY_COMPARE(applicationIds(index.snapshot()),
+                 QStringList() << QStringLiteral("com.ispirata.first") << QStringLiteral("com.ispirata.second"));
+    QVERIFY(index.snapshot().fingerprint() != fingerprint);
+}
+
+void ApplicationIndexTest::rescanOnRemove()
+{
+    QVERIFY(writeService(QStringLiteral("com.ispirata.first")));
+    QVERIFY(writeService(QStringLiteral("com.ispirata.second")));
+    ApplicationIndex index(m_dir->path() + QStringLiteral("/services"));
+    QCOMPARE(index.snapshot().applications().size(), 2);
+
+    QVERIFY(QFile::remove(servicePath(QStringLiteral("com.ispirata.second"))));
+    QTRY_COMPARE(applicationIds(index.snapshot()), QStringList() << QStringLiteral("com.ispirata.first"));
+    QVERIFY(index.snapshot().applicationIdForPackage(QStringLiteral("ha-comispiratasecond")).isEmpty());
+}
+
+void ApplicationIndexTest::rescanOnEdit()
+{
+    QVERIFY(writeService(QStringLiteral("com.ispirata.test"), 1000000000));
+    ApplicationIndex index(m_dir->path() + QStringLiteral("/services"));
+    QByteArray fingerprint = index.snapshot().fingerprint();
+
+    // Edited in place: the directory stays the same, the file does not.
+    QVERIFY(writeService(QStringLiteral("com.ispirata.test"), 1000000100));
+    QTRY_VERIFY(index.snapshot().fingerprint() != fingerprint);
+    QCOMPARE(applicationIds(index.snapshot()), QStringList() << QStringLiteral("com.ispirata.test"));
+
+    // And it is still watched after the rescan.
+    fingerprint = index.snapshot().fingerprint();
+    QVERIFY(writeService(QStringLiteral("com.ispirata.test"), 1000000200));
+    QTRY_VERIFY(index.snapshot().fingerprint() != fingerprint);
+}
+
+void ApplicationIndexTest::snapshotsAreValues()
+{
+    QVERIFY(writeService(QStringLiteral("com.ispirata.first")));
+    ApplicationIndex index(m_dir->path() + QStringLiteral("/services"));
+    ApplicationIndex::Snapshot before = index.snapshot();
+
+    QVERIFY(writeService(QStringLiteral("com.ispirata.second")));
+    QTRY_COMPARE(index.snapshot().applications().size(), 2);
+
+    // Whoever took one keeps what it said back then.
+    QCOMPARE(applicationIds(before), QStringList() << QStringLiteral("com.ispirata.first"));
+}
+
+void ApplicationIndexTest::directoryShowsUpLater()
+{
+    ApplicationIndex index(m_dir->path() + QStringLiteral("/services"));
+    QVERIFY(index.snapshot().applications().isEmpty());
+
+    // Nothing to watch: it looks every time, until the directory is there.
+    QVERIFY(writeService(QStringLiteral("com.ispirata.test")));
+    QCOMPARE(applicationIds(index.snapshot()), QStringList() << QStringLiteral("com.ispirata.test"));
+
+    // From then on, it's watched.
+    QVERIFY(writeService(QStringLiteral("com.ispirata.other")));
+    QTRY_COMPARE(index.snapshot().applications().size(), 2);
+}
+
+QTEST_MAIN(ApplicationIndexTest)
+
+#include "zyppapplicationindextest.moc"
@@ -0,0 +1,193 @@
+#include "zyppapplicationupdatescache.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QTemporaryDir>
+#include <QtTest/QtTest>
+
+#define UPDATES "[{\"applicationId\":\"com.ispirata.test\"}]"
+#define OTHER_UPDATES "[]"
+#define COOKIE "rpmdb-1"
+#define OTHER_COOKIE "rpmdb-2"
+#define SERVICES "com.ispirata.test.ha:1000;"
+#define OTHER_SERVICES "com.ispirata.test.ha:2000;"
+
+class ApplicationUpdatesCacheTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+
+    void keyCoversEverything();
+    void lookupAfterStore();
+    void installedSetChangeInvalidates();
+    void servicesChangeInvalidates();
+    void invalidateKeepsList();
+    void storeTellsChanges();
+    void noKeyNoCache();
+    void surviveRestart();
+    void malformedFile();
+
+private:
+    QString cacheFile() const;
+    QByteArray storedKey() const;
+
+    QTemporaryDir m_dir;
+};
+
+void ApplicationUpdatesCacheTest::init()
+{
+    QVERIFY(m_dir.isValid());
+    QFile::remove(cacheFile());
+}
+
+QString ApplicationUpdatesCacheTest::cacheFile() const
+{
+    // In a directory of its own, which store has to create.
+    return m_dir.path() + QStringLiteral("/zypp-worker/updates.cache");
+}
+
+QByteArray ApplicationUpdatesCacheTest::storedKey() const
+{
+    return ApplicationUpdatesCache::key("state", SERVICES);
+}
+
+void ApplicationUpdatesCacheTest::keyCoversEverything()
+{
+    QByteArray key = ApplicationUpdatesCache::key("state", SERVICES);
+    QVERIFY(!key.isEmpty());
+    QCOMPARE(ApplicationUpdatesCache::key("state", SERVICES), key);
+
+    // Repositories or installed set, and service files.
+    QVERIFY(ApplicationUpdatesCache::key("other state", SERVICES) != key);
+    QVERIFY(ApplicationUpdatesCache::key("state", OTHER_SERVICES) != key);
+
+    // No telling what the system looks like.
+    QVERIFY(ApplicationUpdatesCache::key(QByteArray(), SERVICES).isEmpty());
+}
+
+void ApplicationUpdatesCacheTest::lookupAfterStore()
+{
+    ApplicationUpdatesCache cache(cacheFile());
+    QByteArray applicationUpdates;
+    QVERIFY(!cache.isVerified());
+    QVERIFY(!cache.lookup(COOKIE, SERVICES, applicationUpdates));
+
+    cache.store(UPDATES, storedKey(), COOKIE, SERVICES);
+    QVERIFY(cache.isVerified());
+    QVERIFY(cache.lookup(COOKIE, SERVICES, applicationUpdates));
+    QCOMPARE(applicationUpdates, QByteArray(UPDATES));
+    QCOMPARE(cache.key(), storedKey());
+}
+
+void ApplicationUpdatesCacheTest::installedSetChangeInvalidates()
+{
+    ApplicationUpdatesCache cache(cacheFile());
+    cache.store(UPDATES, storedKey(), COOKIE, SERVICES);
+
+    QByteArray applicationUpdates;
+    QVERIFY(!cache.lookup(OTHER_COOKIE, SERVICES, applicationUpdates));
+    // And stays that way: only the full key can tell whether the list still holds.
+    QVERIFY(!cache.isVerified());
+    QVERIFY(!cache.lookup(COOKIE, SERVICES, applicationUpdates));
+
+    // No rpmdb cookie is never a match.
+    cache.store(UPDATES, storedKey(), QByteArray(), SERVICES);
+    QVERIFY(!cache.lookup(QByteArray(), SERVICES, applicationUpdates));
+}
+
+void ApplicationUpdatesCacheTest::servicesChangeInvalidates()
+{
+    ApplicationUpdatesCache cache(cacheFile());
+    cache.store(UPDATES, storedKey(), COOKIE, SERVICES);
+
+    QByteArray applicationUpdates;
+    QVERIFY(!cache.lookup(COOKIE, OTHER_SERVICES, applicationUpdates));
+    QVERIFY(!cache.lookup(COOKIE, SERVICES, applicationUpdates));
+}
+
+void ApplicationUpdatesCacheTest::invalidateKeepsList()
+{
+    ApplicationUpdatesCache cache(cacheFile());
+    cache.store(UPDATES, storedKey(), COOKIE, SERVICES);
+
+    // Repositories changed, say.
+    cache.invalidate();
+    QByteArray applicationUpdates;
+    QVERIFY(!cache.lookup(COOKIE, SERVICES, applicationUpdates));
+    QCOMPARE(cache.key(), storedKey());
+    QCOMPARE(cache.applicationUpdates(), QByteArray(UPDATES));
+
+    // The full key still matched after all: trusted again, for the state it was confirmed against.
+    cache.confirm(OTHER_COOKIE, SERVICES);
+    QVERIFY(cache.lookup(OTHER_COOKIE, SERVICES, applicationUpdates));
+    QCOMPARE(applicationUpdates, QByteArray(UPDATES));
+}
+
+void ApplicationUpdatesCacheTest::storeTellsChanges()
+{
+    ApplicationUpdatesCache cache(cacheFile());
+    QVERIFY(cache.store(UPDATES, storedKey(), COOKIE, SERVICES));
+    QVERIFY(!cache.store(UPDATES, storedKey(), OTHER_COOKIE, SERVICES));
+    QVERIFY(cache.store(OTHER_UPDATES, storedKey(), OTHER_COOKIE, SERVICES));
+
+    // Whoever got a provisional list hears about the verified one, even if it's the same as before.
+    cache.noteProvisionalServed();
+    QVERIFY(cache.store(OTHER_UPDATES, storedKey(), OTHER_COOKIE, SERVICES));
+    QVERIFY(!cache.store(OTHER_UPDATES, storedKey(), OTHER_COOKIE, SERVICES));
+}
+
+void ApplicationUpdatesCacheTest::noKeyNoCache()
+{
+    ApplicationUpdatesCache cache(cacheFile());
+    QVERIFY(cache.store(UPDATES, QByteArray(), COOKIE, SERVICES));
+
+    QByteArray applicationUpdates;
+    QVERIFY(!cache.isVerified());
+    QVERIFY(!cache.lookup(COOKIE, SERVICES, applicationUpdates));
+    QVERIFY(!QFile::exists(cacheFile()));
+}
+
+void ApplicationUpdatesCacheTest::surviveRestart()
+{
+    {
+        ApplicationUpdatesCache cache(cacheFile());
+        cache.store(UPDATES, storedKey(), COOKIE, SERVICES);
+    }
+    QVERIFY(QFile::exists(cacheFile()));
+
+    ApplicationUpdatesCache cache(cacheFile());
+    cache.load();
+    QCOMPARE(cache.key(), storedKey());
+    QCOMPARE(cache.applicationUpdates(), QByteArray(UPDATES));
+
+    // Whatever the system looks like now, the key has to say so first.
+    QByteArray applicationUpdates;
+    QVERIFY(!cache.isVerified());
+    QVERIFY(!cache.lookup(COOKIE, SERVICES, applicationUpdates));
+    cache.confirm(COOKIE, SERVICES);
+    QVERIFY(cache.lookup(COOKIE, SERVICES, applicationUpdates));
+}
+
+void ApplicationUpdatesCacheTest::malformedFile()
+{
+    ApplicationUpdatesCache cache(cacheFile());
+    cache.load();
+    QVERIFY(cache.key().isEmpty());
+
+    QVERIFY(QDir().mkpath(QFileInfo(cacheFile()).path()));
+    QFile file(cacheFile());
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("no key in here");
+    file.close();
+
+    cache.load();
+    QVERIFY(cache.key().isEmpty());
+    QVERIFY(cache.applicationUpdates().isEmpty());
+}
+
+QTEST_MAIN(ApplicationUpdatesCacheTest)
+
+#include "zyppapplicationupdatescachetest.moc"
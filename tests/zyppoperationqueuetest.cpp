@@ -0,0 +1,182 @@
+#include "zyppoperationqueue.h"
+
+#include <QtCore/QDateTime>
+#include <QtTest/QtTest>
+
+// Aging in these tests: short enough to wait for, long enough for the rest of a test to run within one interval.
+#define TEST_AGING_MSECS 200
+
+class OperationQueueTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void priorityOrder();
+    void agingPromotes();
+    void cancelById();
+    void snapshotReads();
+    void meanDurations();
+    void estimatedStarts();
+
+private:
+    void enqueue(OperationQueue &queue, OperationQueue::Priority priority, const QByteArray &id,
+                 OperationQueue::Access access = OperationQueue::Access::Exclusive);
+    QString takeNext(OperationQueue &queue);
+
+    QStringList m_ran;
+    QStringList m_cancelled;
+};
+
+void OperationQueueTest::enqueue(OperationQueue &queue, OperationQueue::Priority priority, const QByteArray &id,
+                                 OperationQueue::Access access)
+{
+    QString name = QString::fromLatin1(id);
+    queue.enqueue(priority, access, id, name, [this, name] { m_ran.append(name); }, [this, name] { m_cancelled.append(name); });
+}
+
+QString OperationQueueTest::takeNext(OperationQueue &queue)
+{
+    QString name;
+    OperationQueue::Task task = queue.takeNext(nullptr, nullptr, &name);
+    if (task) {
+        task();
+    }
+    return name;
+}
+
+void OperationQueueTest::priorityOrder()
+{
+    OperationQueue queue(TEST_AGING_MSECS);
+    enqueue(queue, OperationQueue::Priority::Background, "background");
+    enqueue(queue, OperationQueue::Priority::Normal, "normal");
+    enqueue(queue, OperationQueue::Priority::Interactive, "interactive");
+    enqueue(queue, OperationQueue::Priority::Normal, "normal-later");
+
+    QCOMPARE(queue.size(), 4);
+    QCOMPARE(takeNext(queue), QStringLiteral("interactive"));
+    // Same class: first come, first served.
+    QCOMPARE(takeNext(queue), QStringLiteral("normal"));
+    QCOMPARE(takeNext(queue), QStringLiteral("normal-later"));
+    QCOMPARE(takeNext(queue), QStringLiteral("background"));
+    QVERIFY(queue.isEmpty());
+    QVERIFY(takeNext(queue).isEmpty());
+}
+
+void OperationQueueTest::agingPromotes()
+{
+    OperationQueue queue(TEST_AGING_MSECS);
+    enqueue(queue, OperationQueue::Priority::Background, "old");
+
+    // Two intervals: background is up with interactive by now, and got there first.
+    QTest::qSleep(2 * TEST_AGING_MSECS + 50);
+    enqueue(queue, OperationQueue::Priority::Interactive, "new");
+
+    QCOMPARE(takeNext(queue), QStringLiteral("old"));
+    QCOMPARE(takeNext(queue), QStringLiteral("new"));
+
+    QVariantMap background = queue.statistics().value(QStringLiteral("background")).toMap();
+    QCOMPARE(background.value(QStringLiteral("dispatched")).toULongLong(), Q_UINT64_C(1));
+    QCOMPARE(background.value(QStringLiteral("aged")).toULongLong(), Q_UINT64_C(1));
+    QVERIFY(background.value(QStringLiteral("maxWait")).toLongLong() >= 2 * TEST_AGING_MSECS);
+}
+
+void OperationQueueTest::cancelById()
+{
+    m_ran.clear();
+    m_cancelled.clear();
+
+    OperationQueue queue(TEST_AGING_MSECS);
+    enqueue(queue, OperationQueue::Priority::Normal, "first");
+    enqueue(queue, OperationQueue::Priority::Normal, "second");
+
+    QCOMPARE(queue.name("first"), QStringLiteral("first"));
+    QVERIFY(queue.cancel("first"));
+    QCOMPARE(m_cancelled, QStringList() << QStringLiteral("first"));
+    QVERIFY(queue.name("first").isEmpty());
+
+    // Gone already, and never there.
+    QVERIFY(!queue.cancel("first"));
+    QVERIFY(!queue.cancel("unknown"));
+
+    QCOMPARE(takeNext(queue), QStringLiteral("second"));
+    QCOMPARE(m_ran, QStringList() << QStringLiteral("second"));
+
+    // A cancelled operation never ran: it's not in the statistics.
+    QVariantMap normal = queue.statistics().value(QStringLiteral("normal")).toMap();
+    QCOMPARE(normal.value(QStringLiteral("dispatched")).toULongLong(), Q_UINT64_C(1));
+
+    // Nobody to tell is fine as well.
+    queue.enqueue(OperationQueue::Priority::Normal, OperationQueue::Access::Exclusive, "quiet", QStringLiteral("quiet"),
+                  OperationQueue::Task(), OperationQueue::Task());
+    QVERIFY(queue.cancel("quiet"));
+}
+
+void OperationQueueTest::snapshotReads()
+{
+    OperationQueue queue(TEST_AGING_MSECS);
+    enqueue(queue, OperationQueue::Priority::Interactive, "write");
+    QVERIFY(!queue.hasSnapshotReads());
+
+    enqueue(queue, OperationQueue::Priority::Normal, "read", OperationQueue::Access::SnapshotRead);
+    QVERIFY(queue.hasSnapshotReads());
+    // Past whatever else is waiting, however urgent.
+    QCOMPARE(queue.takeNextSnapshotRead(), QStringLiteral("read"));
+    QVERIFY(!queue.hasSnapshotReads());
+    QVERIFY(queue.takeNextSnapshotRead().isEmpty());
+
+    QCOMPARE(takeNext(queue), QStringLiteral("write"));
+}
+
+void OperationQueueTest::meanDurations()
+{
+    OperationQueue queue(TEST_AGING_MSECS);
+    queue.recordDuration(QStringLiteral("listUpdates"), 1000);
+    QCOMPARE(queue.meanDurations().value(QStringLiteral("listUpdates")).toLongLong(), Q_INT64_C(1000));
+
+    // A running average, not the last one seen.
+    queue.recordDuration(QStringLiteral("listUpdates"), 2000);
+    qint64 mean = queue.meanDurations().value(QStringLiteral("listUpdates")).toLongLong();
+    QVERIFY(mean > 1000);
+    QVERIFY(mean < 2000);
+}
+
+void OperationQueueTest::estimatedStarts()
+{
+    OperationQueue queue(TEST_AGING_MSECS);
+    queue.recordDuration(QStringLiteral("running"), 3000);
+    queue.recordDuration(QStringLiteral("first"), 1000);
+    queue.recordDuration(QStringLiteral("second"), 2000);
+
+    enqueue(queue, OperationQueue::Priority::Normal, "second");
+    enqueue(queue, OperationQueue::Priority::Interactive, "first");
+    enqueue(queue, OperationQueue::Priority::Background, "never-seen");
+
+    qint64 before = QDateTime::currentMSecsSinceEpoch();
+    QVariantList entries = queue.entries(QStringLiteral("running"), 1000);
+    qint64 after = QDateTime::currentMSecsSinceEpoch();
+
+    // In dispatch order, each one starting when the one before it is expected to be done.
+    QCOMPARE(entries.size(), 3);
+    QVariantMap first = entries.at(0).toMap();
+    QVariantMap second = entries.at(1).toMap();
+    QVariantMap third = entries.at(2).toMap();
+    QCOMPARE(first.value(QStringLiteral("name")).toString(), QStringLiteral("first"));
+    QCOMPARE(second.value(QStringLiteral("name")).toString(), QStringLiteral("second"));
+    QCOMPARE(third.value(QStringLiteral("name")).toString(), QStringLiteral("never-seen"));
+
+    // What is left of the running one.
+    qint64 start = first.value(QStringLiteral("estimatedStart")).toLongLong();
+    QVERIFY(start >= before + 2000);
+    QVERIFY(start <= after + 2000);
+    QCOMPARE(second.value(QStringLiteral("estimatedStart")).toLongLong(), start + 1000);
+    QCOMPARE(third.value(QStringLiteral("estimatedStart")).toLongLong(), start + 3000);
+
+    // Running late: it could be done any moment now.
+    entries = queue.entries(QStringLiteral("running"), 10000);
+    start = entries.at(0).toMap().value(QStringLiteral("estimatedStart")).toLongLong();
+    QVERIFY(start <= QDateTime::currentMSecsSinceEpoch());
+}
+
+QTEST_MAIN(OperationQueueTest)
+
+#include "zyppoperationqueuetest.moc"
@@ -0,0 +1,118 @@
+#include "zypppendingreads.h"
+
+#include <QtTest/QtTest>
+
+#define READ_KEY "listInstalledApplications"
+#define OTHER_READ_KEY "listRepositories"
+
+// Calls are told apart by the tag they carry, callers by their service.
+class PendingReadsTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void firstCallerLeads();
+    void keysAreSeparate();
+    void detachKeepsOthers();
+    void detachLastCaller();
+    void detachUnknown();
+
+private:
+    static QDBusMessage call(const QString &service, const QString &tag);
+    static QStringList tags(const QList< QDBusMessage > &requests);
+};
+
+QDBusMessage PendingReadsTest::call(const QString &service, const QString &tag)
+{
+    QDBusMessage request = QDBusMessage::createMethodCall(service, QStringLiteral("/"),
+                                                          QStringLiteral("com.ispirata.Hemera.SoftwareManager.Backend"),
+                                                          QStringLiteral(READ_KEY));
+    request.setArguments(QVariantList() << tag);
+    return request;
+}
+
+QStringList PendingReadsTest::tags(const QList< QDBusMessage > &requests)
+{
+    QStringList result;
+    for (const QDBusMessage &request : requests) {
+        result.append(request.arguments().value(0).toString());
+    }
+    return result;
+}
+
+void PendingReadsTest::firstCallerLeads()
+{
+    PendingReads reads;
+    QVERIFY(!reads.contains(QStringLiteral(READ_KEY)));
+
+    // The first one goes and gets the answer, the others wait for it.
+    QVERIFY(!reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.1"), QStringLiteral("first"))));
+    QVERIFY(reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.2"), QStringLiteral("second"))));
+    QVERIFY(reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.1"), QStringLiteral("third"))));
+    QVERIFY(reads.contains(QStringLiteral(READ_KEY)));
+    QCOMPARE(reads.coalesced(), Q_UINT64_C(2));
+
+    // One answer for everyone, in arrival order.
+    QCOMPARE(tags(reads.take(QStringLiteral(READ_KEY))),
+             QStringList() << QStringLiteral("first") << QStringLiteral("second") << QStringLiteral("third"));
+    QVERIFY(!reads.contains(QStringLiteral(READ_KEY)));
+
+    // Answered: the next one asks again.
+    QVERIFY(!reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.3"), QStringLiteral("fourth"))));
+    QCOMPARE(reads.coalesced(), Q_UINT64_C(2));
+}
+
+void PendingReadsTest::keysAreSeparate()
+{
+    PendingReads reads;
+    QVERIFY(!reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.1"), QStringLiteral("installed"))));
+    QVERIFY(!reads.join(QStringLiteral(OTHER_READ_KEY), call(QStringLiteral(":1.1"), QStringLiteral("repositories"))));
+    QCOMPARE(reads.coalesced(), Q_UINT64_C(0));
+
+    QCOMPARE(tags(reads.take(QStringLiteral(OTHER_READ_KEY))), QStringList() << QStringLiteral("repositories"));
+    QVERIFY(reads.contains(QStringLiteral(READ_KEY)));
+}
+
+void PendingReadsTest::detachKeepsOthers()
+{
+    PendingReads reads;
+    reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.1"), QStringLiteral("first")));
+    reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.2"), QStringLiteral("second")));
+    reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.1"), QStringLiteral("third")));
+
+    // A caller cancelling lets go of its own calls, and of nobody else's: the operation goes on for them.
+    QCOMPARE(tags(reads.detach(QStringLiteral(READ_KEY), QStringLiteral(":1.1"))),
+             QStringList() << QStringLiteral("first") << QStringLiteral("third"));
+    QVERIFY(reads.contains(QStringLiteral(READ_KEY)));
+
+    QCOMPARE(tags(reads.take(QStringLiteral(READ_KEY))), QStringList() << QStringLiteral("second"));
+}
+
+void PendingReadsTest::detachLastCaller()
+{
+    PendingReads reads;
+    reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.1"), QStringLiteral("first")));
+    reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.1"), QStringLiteral("second")));
+
+    // Nobody left waiting: the key is gone, and so may be the operation.
+    QCOMPARE(tags(reads.detach(QStringLiteral(READ_KEY), QStringLiteral(":1.1"))),
+             QStringList() << QStringLiteral("first") << QStringLiteral("second"));
+    QVERIFY(!reads.contains(QStringLiteral(READ_KEY)));
+    QVERIFY(reads.take(QStringLiteral(READ_KEY)).isEmpty());
+}
+
+void PendingReadsTest::detachUnknown()
+{
+    PendingReads reads;
+    QVERIFY(reads.detach(QStringLiteral(READ_KEY), QStringLiteral(":1.1")).isEmpty());
+
+    reads.join(QStringLiteral(READ_KEY), call(QStringLiteral(":1.1"), QStringLiteral("first")));
+    // Someone who is not waiting can't cancel it for those who are.
+    QVERIFY(reads.detach(QStringLiteral(READ_KEY), QStringLiteral(":1.2")).isEmpty());
+    QVERIFY(reads.contains(QStringLiteral(READ_KEY)));
+    QCOMPARE(tags(reads.take(QStringLiteral(READ_KEY))), QStringList() << QStringLiteral("first"));
+}
+
+QTEST_MAIN(PendingReadsTest)
+
+#include "zypppendingreadstest.moc"
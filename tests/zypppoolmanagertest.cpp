@@ -0,0 +1,204 @@
+#include "zypppoolmanager.h"
+#include "zypptransactionrunner.h"
+#include "zyppworkercallbacks.h"
+
+#include <zypp/PoolItem.h>
+#include <zypp/ResPool.h>
+#include <zypp/Repository.h>
+#include <zypp/ZYppFactory.h>
+#include <zypp/sat/Pool.h>
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+#include <QtTest/QtTest>
+
+#define APPLICATION_PACKAGE "ha-com.ispirata.test"
+#define AVAILABLE_REPO_ALIAS "hemera-test"
+
+// The worker used to restart after every commit, since installing the same package twice in a row
+// failed: marks from the first transaction were still in the pool when the second one was resolved.
+// These tests walk the pool through what the worker does across two transactions, marking and resetting
+// through the worker's own TransactionRunner, with helix files instead of an rpmdb and real repositories.
+class PoolManagerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void init();
+
+    void resetDropsTransaction();
+    void installSamePackageTwice();
+    void removeSurvivesTargetReload();
+
+private:
+    void loadSystem(const QString &file);
+    bool install(const std::string &name);
+    int transacting() const;
+    bool toBeUninstalled(const std::string &name) const;
+
+    QTemporaryDir m_root;
+    zypp::ZYpp::Ptr m_zypp;
+    PoolManager *m_pool;
+    // No backend to report progress to, same as in the zygote
+    CallbacksManager *m_callbacks;
+    TransactionRunner *m_runner;
+    zypp::RepoInfo m_available;
+};
+
+void PoolManagerTest::initTestCase()
+{
+    QVERIFY(m_root.isValid());
+
+    // Keep zypp off the system: lock, configuration, repositories and caches all go in our temporary root.
+    QVERIFY(QDir(m_root.path()).mkpath(QStringLiteral("var/run")));
+    QFile config(m_root.path() + QStringLiteral("/zypp.conf"));
+    QVERIFY(config.open(QIODevice::WriteOnly | QIODevice::Text));
+    config.write(QStringLiteral("[main]\nreposdir = %1/repos.d\ncachedir = %1/cache\n").arg(m_root.path()).toLocal8Bit());
+    config.close();
+
+    qputenv("ZYPP_CONF", QFile::encodeName(config.fileName()));
+    qputenv("ZYPP_LOCKFILE_ROOT", QFile::encodeName(m_root.path()));
+
+    m_zypp = zypp::getZYpp();
+    m_pool = new PoolManager(m_zypp);
+    m_callbacks = new CallbacksManager(nullptr);
+    m_runner = new TransactionRunner(m_zypp, m_pool, m_callbacks);
+
+    m_available.setAlias(AVAILABLE_REPO_ALIAS);
+    m_available.setName(AVAILABLE_REPO_ALIAS);
+}
+
+void PoolManagerTest::cleanupTestCase()
+{
+    delete m_runner;
+    delete m_callbacks;
+    delete m_pool;
+    m_zypp.reset();
+}
+
+void PoolManagerTest::init()
+{
+    m_pool->resetPoolState();
+    zypp::sat::Pool::instance().reposEraseAll();
+
+    loadSystem(QStringLiteral(TEST_DATA_DIR "/system.xml"));
+    // With its RepoInfo, so that markPackage can tell it's one of the repositories it's given.
+    zypp::sat::Pool::instance().addRepoHelix(zypp::Pathname(TEST_DATA_DIR "/available.xml"), m_available);
+}
+
+void PoolManagerTest::loadSystem(const QString &file)
+{
+    // What reloading the target after a commit amounts to: the system repository is replaced, the others stay.
+    zypp::Repository system = zypp::sat::Pool::instance().findSystemRepo();
+    if (system != zypp::Repository::noRepository) {
+        system.eraseFromPool();
+    }
+    zypp::sat::Pool::instance().addRepoHelix(zypp::Pathname(QFile::encodeName(file).constData()), zypp::sat::Pool::systemRepoAlias());
+}
+
+bool PoolManagerTest::install(const std::string &name)
+{
+    std::list<zypp::RepoInfo> repos;
+    repos.push_back(m_available);
+    return m_runner->markPackage(repos, name, TransactionRequest::PackageOperation::Install);
+}
+
+int PoolManagerTest::transacting() const
+{
+    int count = 0;
+    zypp::ResPool pool = zypp::ResPool::instance();
+    for (zypp::ResPool::const_iterator it = pool.begin(); it != pool.end(); ++it) {
+        if (it->status().transacts()) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+bool PoolManagerTest::toBeUninstalled(const std::string &name) const
+{
+    zypp::ResPool pool = zypp::ResPool::instance();
+    for (zypp::ResPool::const_iterator it = pool.begin(); it != pool.end(); ++it) {
+        if (it->name() == name && it->status().isToBeUninstalled()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void PoolManagerTest::resetDropsTransaction()
+{
+    QVERIFY(install(APPLICATION_PACKAGE));
+    QVERIFY(m_zypp->resolver()->resolvePool());
+    // The application, and the runtime it needs.
+    QCOMPARE(transacting(), 2);
+
+    // Same as a failed or cancelled commit: nothing happened on the system, and nothing must be left in the pool.
+    m_runner->endTransaction();
+    QCOMPARE(transacting(), 0);
+
+    // And it can go through again, from scratch.
+    QVERIFY(install(APPLICATION_PACKAGE));
+    QVERIFY(m_zypp->resolver()->resolvePool());
+    QCOMPARE(transacting(), 2);
+}
+
+void PoolManagerTest::installSamePackageTwice()
+{
+    QVERIFY(install(APPLICATION_PACKAGE));
+    QVERIFY(m_zypp->resolver()->resolvePool());
+    QCOMPARE(transacting(), 2);
+
+    // The commit went through: the target is reloaded with the application in, while the marks on the
+    // available items survive. This is where the second install used to go wrong.
+    loadSystem(QStringLiteral(TEST_DATA_DIR "/system-with-application.xml"));
+    QVERIFY(transacting() > 0);
+
+    // What TransactionRunner does once the commit is over.
+    m_runner->endTransaction();
+    QCOMPARE(transacting(), 0);
+
+    // Second time around: it's installed, there's nothing to mark and nothing to do.
+    QVERIFY(!install(APPLICATION_PACKAGE));
+    QVERIFY(m_zypp->resolver()->resolvePool());
+    QCOMPARE(transacting(), 0);
+    QVERIFY(m_zypp->resolver()->problems().empty());
+}
+
+void PoolManagerTest::removeSurvivesTargetReload()
+{
+    loadSystem(QStringLiteral(TEST_DATA_DIR "/system-with-application.xml"));
+
+    TransactionRequest request;
+    request.type = TransactionRequest::Type::Packages;
+    request.intents.append(qMakePair(QStringLiteral(APPLICATION_PACKAGE), TransactionRequest::PackageOperation::Remove));
+
+    QString errorName;
+    QString errorMessage;
+    QVERIFY(m_runner->prepare(request, errorName, errorMessage));
+    QVERIFY(toBeUninstalled(APPLICATION_PACKAGE));
+    int transaction = transacting();
+    QVERIFY(transaction > 0);
+
+    // What the download pass of a commit leaves behind: the target is reloaded, and the removal with it.
+    loadSystem(QStringLiteral(TEST_DATA_DIR "/system-with-application.xml"));
+    QVERIFY(!toBeUninstalled(APPLICATION_PACKAGE));
+
+    // Which is why the commit prepares the request again before going on: same transaction as before.
+    QVERIFY(m_runner->prepare(request, errorName, errorMessage));
+    QVERIFY(toBeUninstalled(APPLICATION_PACKAGE));
+    QCOMPARE(transacting(), transaction);
+
+    m_runner->endTransaction();
+    QCOMPARE(transacting(), 0);
+}
+
+QTEST_MAIN(PoolManagerTest)
+
+#include "zypppoolmanagertest.moc"
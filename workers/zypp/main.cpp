@@ -1,5 +1,7 @@
+#include <QtCore/QCommandLineParser>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QSocketNotifier>
 #include <QtCore/QTimer>
 
@@ -14,6 +16,7 @@
 #include <sys/socket.h>
 
 #include "zyppbackend.h"
+#include "zyppzygote.h"
 
 static int sighupFd[2];
 static int sigtermFd[2];
@@ -56,6 +59,10 @@ static int setup_unix_signal_handlers()
 
 int main(int argc, char *argv[])
 {
+    // Measures how long it takes us to get to the backend
+    QElapsedTimer startupTimer;
+    startupTimer.start();
+
     QCoreApplication app(argc, argv);
 
     app.setApplicationName(QStringLiteral("Hemera SoftwareManager Zypp Worker"));
@@ -63,6 +70,19 @@ int main(int argc, char *argv[])
     app.setOrganizationDomain(QStringLiteral("com.ispirata.hemera"));
     app.setOrganizationName(QStringLiteral("Ispirata"));
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption zygoteOption(QStringLiteral("zygote"),
+                                    QStringLiteral("Run every transaction modifying the system in a process of its own, forked from a zygote."));
+    parser.addOption(zygoteOption);
+    parser.process(app);
+
+    // Now or never: forking is only safe as long as we are the only thread around, and the bus,
+    // the executor and the rest will be starting theirs soon. The zygote outlives reloads.
+    if (parser.isSet(zygoteOption) && ZyppZygote::spawn() < 0) {
+        qWarning() << "Could not start the zygote, transactions will run in process.";
+    }
+
     ZyppBackend *backend;
 
     auto shutMeDown = [&] () {
@@ -90,6 +110,11 @@ int main(int argc, char *argv[])
         qDebug() << "Starting...";
 
         backend = new ZyppBackend;
+        if (startupTimer.isValid()) {
+            // Only meaningful on the first start, not on reloads.
+            backend->recordStartupPhase(QStringLiteral("application"), startupTimer.elapsed());
+            startupTimer.invalidate();
+        }
         // Manage timebomb
         QObject::connect(backend, &ZyppBackend::explode, shutDownApplication);
 
@@ -0,0 +1,108 @@
+#include "zyppapplicationindex.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QStringList>
+
+ApplicationIndex::ApplicationIndex(const QString &servicesPath, QObject *parent)
+    : QObject(parent)
+    , m_servicesPath(servicesPath)
+    , m_watcher(new QFileSystemWatcher(this))
+    , m_dirty(true)
+{
+    // Services come and go as files are added or removed, that's what the directory tells us. Edits in place
+    // only show on the files themselves: they get watched as well, once scanned.
+    if (!m_watcher->addPath(m_servicesPath)) {
+        qWarning() << "Could not watch" << m_servicesPath << ", applications will be scanned on every request.";
+    }
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &ApplicationIndex::onServicesChanged);
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, this, &ApplicationIndex::onServicesChanged);
+}
+
+ApplicationIndex::~ApplicationIndex()
+{
+}
+
+ApplicationIndex::Snapshot ApplicationIndex::snapshot()
+{
+    ensureFresh();
+    return m_snapshot;
+}
+
+const QList<ApplicationIndex::Application> &ApplicationIndex::Snapshot::applications() const
+{
+    return m_applications;
+}
+
+QString ApplicationIndex::Snapshot::applicationIdForPackage(const QString &packageName) const
+{
+    QHash< QString, QString >::const_iterator it = m_byPackageName.constFind(packageName);
+    if (it != m_byPackageName.constEnd()) {
+        return it.value();
+    }
+
+    // Packages with dots in their name still map to their application.
+    if (!packageName.startsWith(QStringLiteral("ha-"))) {
+        return QString();
+    }
+    QString trimmedPackageName = packageName.mid(3);
+    trimmedPackageName.remove(QLatin1Char('.'));
+    return m_byTrimmedId.value(trimmedPackageName);
+}
+
+QByteArray ApplicationIndex::Snapshot::fingerprint() const
+{
+    return m_fingerprint;
+}
+
+void ApplicationIndex::onServicesChanged()
+{
+    // Rescan when someone asks: an installation touches the directory more than once.
+    m_dirty = true;
+}
+
+void ApplicationIndex::ensureFresh()
+{
+    // Without a watcher we can't know, so we always look.
+    if (!m_dirty && !m_watcher->directories().isEmpty()) {
+        return;
+    }
+
+    if (m_watcher->directories().isEmpty() && QFileInfo(m_servicesPath).isDir()) {
+        // The directory showed up meanwhile. Watch before scanning, or we might miss what happens in between.
+        m_watcher->addPath(m_servicesPath);
+    }
+
+    m_snapshot = Snapshot();
+
+    // Files replaced rather than edited drop out of the watcher: start over with what's there now.
+    if (!m_watcher->files().isEmpty()) {
+        m_watcher->removePaths(m_watcher->files());
+    }
+
+    QStringList serviceFiles;
+    QDir hemeraServices(m_servicesPath);
+    hemeraServices.setFilter(QDir::Files | QDir::NoSymLinks);
+    for (const QFileInfo &file : hemeraServices.entryInfoList(QStringList() << QStringLiteral("*.ha"))) {
+        Application application;
+        application.applicationId = file.completeBaseName();
+        application.trimmedId = application.applicationId;
+        application.trimmedId.remove(QLatin1Char('.'));
+        application.packageName = QStringLiteral("ha-%1").arg(application.trimmedId);
+
+        m_snapshot.m_applications.append(application);
+        m_snapshot.m_byPackageName.insert(application.packageName, application.applicationId);
+        m_snapshot.m_byTrimmedId.insert(application.trimmedId, application.applicationId);
+        m_snapshot.m_fingerprint.append(file.fileName().toUtf8() + ':' + QByteArray::number(file.lastModified().toMSecsSinceEpoch()) + ';');
+        serviceFiles.append(file.absoluteFilePath());
+    }
+
+    if (!serviceFiles.isEmpty() && !m_watcher->directories().isEmpty()) {
+        m_watcher->addPaths(serviceFiles);
+    }
+
+    qDebug() << "Indexed" << m_snapshot.m_applications.size() << "applications.";
+    m_dirty = false;
+}
@@ -0,0 +1,66 @@
+#ifndef ZYPPAPPLICATIONINDEX_H
+#define ZYPPAPPLICATIONINDEX_H
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+class QFileSystemWatcher;
+
+// Hemera applications on the system, as told by their service files. The services directory is scanned once,
+// and again only after it or one of its files changed: queries never touch the disk otherwise. The index lives on the main thread,
+// whoever else needs it gets a snapshot.
+class ApplicationIndex : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ApplicationIndex)
+
+public:
+    struct Application {
+        QString applicationId;
+        // The application id without dots, as it appears in package names
+        QString trimmedId;
+        QString packageName;
+    };
+
+    // What the index knew at some point, by value.
+    class Snapshot {
+    public:
+        const QList<Application> &applications() const;
+        // Empty if the package belongs to no known application.
+        QString applicationIdForPackage(const QString &packageName) const;
+        // Changes whenever a service file is added, removed or modified.
+        QByteArray fingerprint() const;
+
+    private:
+        QList<Application> m_applications;
+        // name and mtime of every service file
+        QByteArray m_fingerprint;
+        // package name -> application id
+        QHash< QString, QString > m_byPackageName;
+        // trimmed id -> application id
+        QHash< QString, QString > m_byTrimmedId;
+
+        friend class ApplicationIndex;
+    };
+
+    explicit ApplicationIndex(const QString &servicesPath, QObject *parent = nullptr);
+    virtual ~ApplicationIndex();
+
+    Snapshot snapshot();
+
+private Q_SLOTS:
+    void onServicesChanged();
+
+private:
+    void ensureFresh();
+
+    QString m_servicesPath;
+    QFileSystemWatcher *m_watcher;
+    bool m_dirty;
+
+    Snapshot m_snapshot;
+};
+
+#endif // ZYPPAPPLICATIONINDEX_H
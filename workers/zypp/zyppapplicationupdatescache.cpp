@@ -0,0 +1,130 @@
+#include "zyppapplicationupdatescache.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+
+ApplicationUpdatesCache::ApplicationUpdatesCache(const QString &fileName)
+    : m_fileName(fileName)
+    , m_verified(false)
+    , m_provisionalServed(false)
+{
+}
+
+ApplicationUpdatesCache::~ApplicationUpdatesCache()
+{
+}
+
+QByteArray ApplicationUpdatesCache::key(const QByteArray &stateFingerprint, const QByteArray &servicesFingerprint)
+{
+    if (stateFingerprint.isEmpty()) {
+        return QByteArray();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(stateFingerprint);
+    // Application ids come from the service files, so they are part of the answer as well.
+    hash.addData(servicesFingerprint);
+    return hash.result().toHex();
+}
+
+bool ApplicationUpdatesCache::lookup(const QByteArray &cookie, const QByteArray &services, QByteArray &applicationUpdatesJson)
+{
+    if (!m_verified) {
+        return false;
+    }
+
+    // Without a cookie, there's no knowing whether the installed set changed.
+    if (cookie.isEmpty() || m_cookie != cookie) {
+        // Repositories only change through us, and we'd know. The installed set can change behind our back.
+        m_verified = false;
+        return false;
+    }
+
+    // An edit to any service file might change the answer.
+    if (m_services != services) {
+        m_verified = false;
+        return false;
+    }
+
+    applicationUpdatesJson = m_applicationUpdates;
+    return true;
+}
+
+bool ApplicationUpdatesCache::isVerified() const
+{
+    return m_verified;
+}
+
+void ApplicationUpdatesCache::invalidate()
+{
+    m_verified = false;
+}
+
+QByteArray ApplicationUpdatesCache::key() const
+{
+    return m_key;
+}
+
+QByteArray ApplicationUpdatesCache::applicationUpdates() const
+{
+    return m_applicationUpdates;
+}
+
+void ApplicationUpdatesCache::confirm(const QByteArray &cookie, const QByteArray &services)
+{
+    m_cookie = cookie;
+    m_services = services;
+    m_verified = !m_key.isEmpty();
+}
+
+bool ApplicationUpdatesCache::store(const QByteArray &applicationUpdatesJson, const QByteArray &key,
+                                    const QByteArray &cookie, const QByteArray &services)
+{
+    bool changed = applicationUpdatesJson != m_applicationUpdates || m_provisionalServed;
+    m_provisionalServed = false;
+    m_applicationUpdates = applicationUpdatesJson;
+    m_key = key;
+    confirm(cookie, services);
+
+    if (!m_verified) {
+        qWarning() << "Can't tell the state of the system, not caching the update list.";
+        return changed;
+    }
+
+    QDir().mkpath(QFileInfo(m_fileName).path());
+    QSaveFile cache(m_fileName);
+    if (!cache.open(QIODevice::WriteOnly) || cache.write(m_key + '\n' + m_applicationUpdates) < 0 || !cache.commit()) {
+        qWarning() << "Could not write the update list cache:" << cache.errorString();
+    }
+
+    return changed;
+}
+
+void ApplicationUpdatesCache::noteProvisionalServed()
+{
+    m_provisionalServed = true;
+}
+
+void ApplicationUpdatesCache::load()
+{
+    QFile cache(m_fileName);
+    if (!cache.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    // Validated against the system whenever it's used: just take it for now.
+    QByteArray contents = cache.readAll();
+    int newline = contents.indexOf('\n');
+    if (newline <= 0) {
+        qWarning() << "Discarding malformed update list cache.";
+        return;
+    }
+
+    m_key = contents.left(newline);
+    m_applicationUpdates = contents.mid(newline + 1);
+    m_verified = false;
+}
@@ -0,0 +1,50 @@
+#ifndef ZYPPAPPLICATIONUPDATESCACHE_H
+#define ZYPPAPPLICATIONUPDATESCACHE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+// The last update list the solver came up with, and the state of the system it was resolved against. Checking the
+// full key takes reading the pool. Once it matched, the rpmdb cookie and the service files fingerprint are enough,
+// until something invalidates the list. The list itself is kept either way: it tells whether the next one changed.
+class ApplicationUpdatesCache {
+public:
+    // fileName: where the list survives restarts.
+    explicit ApplicationUpdatesCache(const QString &fileName);
+    ~ApplicationUpdatesCache();
+
+    // stateFingerprint as told by PoolManager, servicesFingerprint as told by ApplicationIndex. Empty if
+    // the state of the system can't be told: no key matches that.
+    static QByteArray key(const QByteArray &stateFingerprint, const QByteArray &servicesFingerprint);
+
+    // The list, if it still holds for cookie and services. Anything else invalidates it.
+    bool lookup(const QByteArray &cookie, const QByteArray &services, QByteArray &applicationUpdatesJson);
+    // Whether lookup can tell anything without the full key.
+    bool isVerified() const;
+    void invalidate();
+
+    // What the list was resolved against, and the list.
+    QByteArray key() const;
+    QByteArray applicationUpdates() const;
+
+    // The full key matched: trust the list for cookie and services again.
+    void confirm(const QByteArray &cookie, const QByteArray &services);
+    // Returns whether whoever holds the previous list, or a provisional one, needs to hear about this one.
+    bool store(const QByteArray &applicationUpdatesJson, const QByteArray &key, const QByteArray &cookie, const QByteArray &services);
+    // A list which is not ours went out: the next store is news, whatever it holds.
+    void noteProvisionalServed();
+
+    // Key and list from the last run. Not verified: the key needs to be checked first.
+    void load();
+
+private:
+    QString m_fileName;
+    QByteArray m_applicationUpdates;
+    QByteArray m_key;
+    QByteArray m_cookie;
+    QByteArray m_services;
+    bool m_verified;
+    bool m_provisionalServed;
+};
+
+#endif // ZYPPAPPLICATIONUPDATESCACHE_H
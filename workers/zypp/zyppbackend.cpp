@@ -4,16 +4,30 @@
 
 #include "zyppbackend.h"
 
+#include "zyppapplicationindex.h"
+#include "zyppapplicationupdatescache.h"
 #include "zyppworkercallbacks.h"
+#include "zypppoolmanager.h"
+#include "zyppoperationqueue.h"
+#include "zypptransactionrunner.h"
+#include "zyppzygote.h"
 #include "workersglobalhelpers.h"
 #include "softwaremanagerinterface.h"
 
 #include <QtCore/QDebug>
+#include <QtCore/QFutureWatcher>
 #include <QtCore/QJsonArray>
 #include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QJsonValue>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QThreadPool>
 #include <QtCore/QTimer>
 #include <QtCore/QUuid>
 
+#include <QtConcurrent/QtConcurrentRun>
+
 #include <QtDBus/QDBusConnection>
 #include <QtDBus/QDBusMessage>
 
@@ -26,7 +40,6 @@
 
 #include <private/HemeraSoftwareManagement/hemerasoftwaremanagementconstructors_p.h>
 
-#include <zypp/FileChecker.h>
 #include <zypp/ZYppFactory.h>
 #include <zypp/Pathname.h>
 #include <zypp/RepoManager.h>
@@ -34,13 +47,21 @@
 #include <zypp/PoolItemBest.h>
 #include <zypp/PoolQuery.h>
 #include <zypp/RepoInfo.h>
+#include <zypp/Repository.h>
 
-#include <zypp/media/MediaException.h>
 #include <zypp/parser/ParseException.h>
-#include <zypp/target/rpm/RpmHeader.h>
+#include <zypp/sat/Pool.h>
 
 #include "backendadaptor.h"
 
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include <systemd/sd-daemon.h>
+
 #include <softwaremanagerconfig.h>
 
 
@@ -53,7 +74,8 @@ if (connection().name() != QDBusConnection::systemBus().name()) { \
     qWarning() << "Someone just tried to hijack the service from a different bus." << connection().name() << request; \
     sendErrorReply(QDBusError::errorString(QDBusError::AccessDenied), QStringLiteral("Sorry, you're not allowed to chime in here.")); \
     return BaseReturnType(); \
-}
+} \
+noteIncomingRequest();
 
 #define CHECK_DBUS_CALLER_VOID \
 if (!calledFromDBus()) { \
@@ -64,14 +86,8 @@ if (connection().name() != QDBusConnection::systemBus().name()) { \
     qWarning() << "Someone just tried to hijack the service from a different bus." << connection().name() << request; \
     sendErrorReply(QDBusError::errorString(QDBusError::AccessDenied), QStringLiteral("Sorry, you're not allowed to chime in here.")); \
     return; \
-}
-
-#define ENQUEUE_OPERATION \
-while (m_status != static_cast<uint>(Status::Idle)) {\
-    QEventLoop e;\
-    connect(this, &ZyppBackend::statusChanged, &e, &QEventLoop::quit, Qt::QueuedConnection);\
-    e.exec();\
-}
+} \
+noteIncomingRequest();
 
 #define HANDLE_OPERATION_DBUS(op)\
 connect(op, &Hemera::Operation::finished, [this, op, request] {\
@@ -84,247 +100,111 @@ connect(op, &Hemera::Operation::finished, [this, op, request] {\
     setStatus(Status::Idle);\
 });
 
-#define TMP_RPM_REPO_ALIAS "hemera-temp-local-repo"
-
-zypp::PoolItem zypp_get_installed_obj(zypp::ui::Selectable::Ptr & s)
-{
-    zypp::PoolItem installed;
-    if (zypp::traits::isPseudoInstalled(s->kind())) {
-        for_(it, s->availableBegin(), s->availableEnd())
-        // this is OK also for patches - isSatisfied() excludes !isRelevant()
-        if (it->status().isSatisfied()
-            && (!installed || installed->edition() < (*it)->edition())) {
-            installed = *it;
-        }
-    } else {
-        installed = s->installedObj();
-    }
-
-    return installed;
-}
-
-void zypp_prepare_pool(zypp::ZYpp::Ptr m_zypp, zypp::RepoManager *manager)
-{
-    // Load resolvables first, from repos and our target.
-    std::list<zypp::RepoInfo> repos;
-    repos.insert(repos.end(), manager->repoBegin(), manager->repoEnd());
-    qDebug() << "Found " << repos.size() << " repos.";
-
-    for (std::list<zypp::RepoInfo>::const_iterator it = repos.begin(); it != repos.end(); ++it) {
-        zypp::RepoInfo repo(*it);
-
-        if (!it->enabled()) {
-            // Skip disabled repos
-            continue;
-        }
-
-        try {
-            bool error = false;
-            // if there is no metadata locally
-            if (manager->metadataStatus(repo).empty()) {
-                // TODO: See refresh_raw_metadata. Here we need to force a raw metadata refresh if
-                //       the metadata is empty.
-            }
-
-            if (!error && !manager->isCached(repo)) {
-                try {
-                    manager->buildCache(repo, zypp::RepoManager::BuildIfNeeded);
-                } catch (const zypp::parser::ParseException & e) {
-                    ZYPP_CAUGHT(e);
-
-                    qWarning() << "Error parsing metadata for" << repo.alias().c_str();
-                    continue;
-                } catch (const zypp::repo::RepoMetadataException & e) {
-                    ZYPP_CAUGHT(e);
-
-                    // this should not happen and is probably a bug.
-                    qWarning() << "Repository metadata for" << repo.alias().c_str() << "not found in local cache. This should not happen.";
-                    continue;
-                } catch (const zypp::Exception &e) {
-                    ZYPP_CAUGHT(e);
-
-                    qWarning() << "Error writing to cache db";
-                    continue;
-                }
-            }
-
-            if (error) {
-                qDebug() << "Error loading resolvables for " << repo.alias().c_str();
-                continue;
-            }
-
-            manager->loadFromCache(repo);
-
-            // check that the metadata is not outdated
-            zypp::Repository robj = zypp::sat::Pool::instance().reposFind(repo.alias());
-            if (robj != zypp::Repository::noRepository && robj.maybeOutdated()) {
-                qWarning() << "Repository" << repo.alias().c_str() << "appears to be outdated. Consider using a different mirror or server.";
-            }
-        } catch (const zypp::Exception & e) {
-            ZYPP_CAUGHT(e);
+#define OPERATION_CANCELLED_ERROR "com.ispirata.Hemera.SoftwareManager.Error.Cancelled"
 
-            qWarning() << "Resolvables from" << repo.alias().c_str() << "not loaded because of error.";
-        }
-    }
-    try {
-        m_zypp->target()->load();
-    } catch ( const zypp::Exception & e ) {
-        ZYPP_CAUGHT(e);
-        qWarning() << "Problem occured while reading the installed packages:" << e.asUserHistory().c_str();
-    }
+// Last resolved update list: its key on the first line, the list itself on the rest.
+#define APPLICATION_UPDATES_CACHE_FILE "/var/cache/hemera/zypp-worker/updates.cache"
 
-    // Ok, resolvables loaded.
+// How an update list came to be: straight from the pool, or confirmed by the solver.
+#define UPDATES_MODE_PROVISIONAL "provisional"
+#define UPDATES_MODE_VERIFIED "verified"
 
-    m_zypp->resolver()->setAllowVendorChange(false);
-    m_zypp->resolver()->setCleandepsOnRemove(true);
-    m_zypp->resolver()->setForceResolve(true);
-    m_zypp->resolver()->setIgnoreAlreadyRecommended(true);
-    m_zypp->resolver()->setOnlyRequires(false);
-    m_zypp->resolver()->setSolveSrcPackages(false);
-    m_zypp->resolver()->setSystemVerification(true);
-}
+// Idle policy. We wait for the next request as long as it is expected to come soon, and quit early when things are quiet.
+#define IDLE_TIMEOUT_DEFAULT_MSECS (15 * 1000)
+#define IDLE_TIMEOUT_MIN_MSECS (5 * 1000)
+#define IDLE_TIMEOUT_MAX_MSECS (2 * 60 * 1000)
+#define IDLE_TIMEOUT_MEMORY_PRESSURE_MSECS 1000
+// How many mean inter-arrival times we are willing to wait for, and how fast the mean follows the traffic.
+#define IDLE_TIMEOUT_INTERVAL_FACTOR 3
+#define IDLE_TIMEOUT_SMOOTHING 0.3
 
-bool ZyppBackend::markPackage(const std::list< zypp::RepoInfo > &repos, const std::string &packageName, ZyppBackend::PackageOperation operation, bool force)
+static Hemera::SoftwareManagement::ApplicationUpdate applicationUpdateFromPackages(const QString &applicationId, zypp::ResObject::constPtr res,
+                                                                                  zypp::ui::Selectable::constPtr s)
 {
-    zypp::PoolQuery q;
-    q.addKind(zypp::ResKind::package);
-    q.setMatchGlob();
-    for (std::list<zypp::RepoInfo>::const_iterator it = repos.begin(); it != repos.end(); ++it) {
-        q.addRepo((*it).alias());
+    // Get the installed package first of all.
+    zypp::ResObject::constPtr installed;
+    if (s->hasInstalledObj()) {
+        installed = s->installedObj().resolvable();
     }
 
-    // Look for package names
-    q.addDependency(zypp::sat::SolvAttr::name, packageName);
-
-    // get the best matching items and tag them for installation.
-    // FIXME this ignores vendor lock - we need some way to do --from which
-    // would respect vendor lock: e.g. a new Selectable::updateCandidateObj(Options&)
-    zypp::PoolItemBest bestMatches(q.begin(), q.end());
-    if (!bestMatches.empty()) {
-        bool completed = false;
-        for (zypp::PoolItemBest::iterator sit = bestMatches.begin(); sit != bestMatches.end(); ++sit) {
-            zypp::ui::Selectable::Ptr s(zypp::ui::asSelectable()(*sit));
-
-            // What are we doing?
-            switch (operation) {
-                case PackageOperation::Install:
-                    if (s->hasInstalledObj()) {
-                        // Are we forcing?
-                        if (force) {
-                            // It's ok then, let's just insist.
-                            (*sit).status().setToBeInstalled(zypp::ResStatus::USER);
-                            qDebug() << "A candidate is already installed, forcing the selected one to be installed";
-                            completed = true;
-                        } else {
-                            // Ouch. Move on, even though it's going to be a failure 99%
-                        }
-                    } else {
-                        s->setOnSystem(*sit);
-                        qDebug() << "Marked a solvable to be on system";
-                        completed = true;
-                    }
-                    break;
-                case PackageOperation::Remove:
-                    if (sit->status().isInstalled()) {
-                        // Got it!
-                        (*sit).status().setToBeUninstalled(zypp::ResStatus::USER);
-                        qDebug() << "Marked a package for removal";
-                        completed = true;
-                    } else {
-                        // Move on...
-                    }
-                    break;
-                case PackageOperation::Update: {
-                        zypp::PoolItem instobj = zypp_get_installed_obj(s);
-                        if (instobj) {
-                            if (s->availableEmpty()) {
-                                // Damn.
-                                break;
-                            }
-
-                            // check vendor (since PoolItemBest does not do it)
-                            // FIXME: Do we need this?
-                            // bool changes_vendor = ! VendorAttr::instance().equivalent(
-                            //           instobj->vendor(), (*sit)->vendor());
-
-                            zypp::PoolItem best;
-                            if ((best = s->updateCandidateObj())) {
-                                zypp::ui::asSelectable()(best)->setOnSystem(best);
-                                completed = true;
-                            } else {
-                                // No match.
-                            }
-                        }
-                    }
-                    break;
-                case PackageOperation::InstallOrUpdate: {
-                    if (s->hasInstalledObj()) {
-                        // Can we update?
-                        zypp::PoolItem instobj = zypp_get_installed_obj(s);
-                        if (instobj) {
-                            if (s->availableEmpty()) {
-                                // Are we forcing?
-                                if (force) {
-                                    // It's ok then, let's just insist.
-                                    (*sit).status().setToBeInstalled(zypp::ResStatus::USER);
-                                    qDebug() << "A candidate is already installed, forcing the selected one to be installed";
-                                    completed = true;
-                                } else {
-                                    // Ouch. Move on, even though it's going to be a failure 99%
-                                }
-                            }
-
-                            // check vendor (since PoolItemBest does not do it)
-                            // FIXME: Do we need this?
-                            // bool changes_vendor = ! VendorAttr::instance().equivalent(
-                            //           instobj->vendor(), (*sit)->vendor());
-
-                            zypp::PoolItem best;
-                            if ((best = s->updateCandidateObj())) {
-                                zypp::ui::asSelectable()(best)->setOnSystem(best);
-                                completed = true;
-                            } else {
-                                // No match.
-                            }
-                        }
-                    } else {
-                        s->setOnSystem(*sit);
-                        qDebug() << "Marked a solvable to be on system";
-                        completed = true;
-                    }
-                    break;
-                }
-                default:
-                    // Wat?
-                    return false;
-            }
-
-            if (completed) {
-                // We're done
-                return true;
-            }
-        }
-    } else {
-        // Ouch.
-        return false;
-    }
+    using namespace Hemera::SoftwareManagement;
 
-    // If we got here, it didn't go that well.
-    return false;
+    return Constructors::applicationUpdateFromData(applicationId,
+                                                   QString::fromStdString(res->summary()),
+                                                   QString::fromStdString(res->description()),
+                                                   installed ? QString::fromStdString(installed->edition().asString()) : QString(),
+                                                   QString::fromStdString(res->edition().asString()),
+                                                   res->downloadSize(),
+                                                   // Compute installed size (for the update only)
+                                                   installed ? res->installSize().blocks(zypp::ByteCount::B) - installed->installSize().blocks(zypp::ByteCount::B)
+                                                             : res->installSize().blocks(zypp::ByteCount::B),
+                                                   // TODO: How to handle changelog?
+                                                   QString());
 }
 
 ZyppBackend::ZyppBackend(QObject *parent)
     : Hemera::AsyncInitDBusObject(parent)
     , m_status(static_cast<uint>(Status::Uninitialized))
     , m_timebomb(new QTimer(this))
+    , m_meanRequestInterval(-1)
+    , m_memoryPressure(false)
     , m_callbacks(nullptr)
+    , m_pool(nullptr)
+    , m_runner(nullptr)
+    , m_applications(nullptr)
+    , m_queue(new OperationQueue)
+    , m_executor(new QThreadPool(this))
+    , m_runningAccess(OperationQueue::Access::Exclusive)
+    , m_transactionPid(-1)
+    , m_transactionInZygote(false)
+    , m_applicationUpdates(QStringLiteral(APPLICATION_UPDATES_CACHE_FILE))
+    , m_applicationUpdatesHits(0)
+    , m_applicationUpdatesMisses(0)
+    , m_precomputingApplicationUpdates(false)
 {
+    // libzypp is not meant to be used from several threads: always the same one, never expiring.
+    m_executor->setMaxThreadCount(1);
+    m_executor->setExpiryTimeout(-1);
 }
 
 ZyppBackend::~ZyppBackend()
 {
+    // Let whatever is running on the executor finish before pulling the rug.
+    m_executor->waitForDone();
+
+    delete m_runner;
     // Destroy the callbacks
     delete m_callbacks;
+    // And drop our pool
+    delete m_pool;
+    // Whoever is still waiting will get no reply from us.
+    delete m_queue;
+}
+
+void ZyppBackend::recordStartupPhase(const QString &phase, qint64 msecs)
+{
+    qDebug() << "Startup phase" << phase << "took" << msecs << "msecs.";
+    sd_notifyf(0, "STATUS=Starting up: %s took %lld msecs", phase.toLatin1().constData(), static_cast<long long>(msecs));
+
+    m_startupTimings.insert(phase, msecs);
+    Q_EMIT startupTimingsChanged();
+}
+
+QVariantMap ZyppBackend::startupTimings() const
+{
+    return m_startupTimings;
+}
+
+QVariantMap ZyppBackend::poolStatistics() const
+{
+    QVariantMap statistics;
+    if (m_pool) {
+        statistics.insert(QStringLiteral("rpmdbCookieHits"), m_pool->rpmdbCookieHits());
+        statistics.insert(QStringLiteral("rpmdbCookieMisses"), m_pool->rpmdbCookieMisses());
+        statistics.insert(QStringLiteral("updatesCacheHits"), m_applicationUpdatesHits);
+        statistics.insert(QStringLiteral("updatesCacheMisses"), m_applicationUpdatesMisses);
+    }
+    return statistics;
 }
 
 void ZyppBackend::setStatus(ZyppBackend::Status status)
@@ -332,8 +212,21 @@ void ZyppBackend::setStatus(ZyppBackend::Status status)
     if (static_cast<uint>(status) != m_status) {
         // Timebomb first.
         if (status == Status::Idle) {
-            qDebug() << "Starting our idle timebomb.";
-            m_timebomb->start();
+            // Whatever was running is over, and so is its snapshot.
+            if (!m_runningOperationName.isEmpty()) {
+                m_queue->recordDuration(m_runningOperationName, m_runningOperationTimer.elapsed());
+            }
+            m_runningAccess = OperationQueue::Access::Exclusive;
+            m_runningOperationId = QByteArray();
+            m_runningOperationName.clear();
+            m_readSnapshot.clear();
+
+            if (m_queue->isEmpty()) {
+                armTimebomb();
+            } else {
+                // Someone is waiting, no time to sleep.
+                QMetaObject::invokeMethod(this, "dispatchOperation", Qt::QueuedConnection);
+            }
 
             // Also, reset callbacks
             m_callbacks->setOperationType(CallbacksManager::OperationType::NoOperation);
@@ -354,6 +247,314 @@ void ZyppBackend::setStatus(ZyppBackend::Status status)
 
         m_status = static_cast<uint>(status);
         Q_EMIT statusChanged(m_status);
+        Q_EMIT queueChanged();
+    }
+}
+
+void ZyppBackend::enqueueOperation(OperationQueue::Priority priority, OperationQueue::Access access, const QDBusMessage &request,
+                                   const QString &name, const OperationQueue::Task &task, const OperationQueue::Task &cancelled)
+{
+    QByteArray id = Workers::generateTransactionId(QDateTime::currentDateTime());
+    // Reads join their pending read before getting here, first caller included: when one gets cancelled,
+    // everyone still waiting for it gets the error. Anything else has just its own request to answer.
+    bool pendingRead = m_pendingReads.contains(name);
+    m_queue->enqueue(priority, access, id, name, task, [this, request, name, pendingRead, cancelled] {
+        if (pendingRead) {
+            replyErrorToPendingRead(name, QStringLiteral(OPERATION_CANCELLED_ERROR), QStringLiteral("The operation has been cancelled."));
+        } else if (request.type() == QDBusMessage::MethodCallMessage) {
+            QDBusConnection::systemBus().send(request.createErrorReply(QStringLiteral(OPERATION_CANCELLED_ERROR),
+                                                                       QStringLiteral("The operation has been cancelled.")));
+        }
+
+        if (cancelled) {
+            cancelled();
+        }
+    });
+
+    if (m_status == static_cast<uint>(Status::Idle) ||
+        (access == OperationQueue::Access::SnapshotRead && m_runningAccess == OperationQueue::Access::Download)) {
+        // Never run from within the D-Bus call: the queue decides what's next.
+        QMetaObject::invokeMethod(this, "dispatchOperation", Qt::QueuedConnection);
+    }
+
+    Q_EMIT queueChanged();
+}
+
+void ZyppBackend::dispatchOperation()
+{
+    if (m_status == static_cast<uint>(Status::Processing) && m_runningAccess == OperationQueue::Access::Download) {
+        if (m_readSnapshot.isEmpty()) {
+            // Still being taken, we'll be back once it's there.
+            return;
+        }
+        // The running writer is just downloading: repositories and installed set are still what we took a snapshot of.
+        while (m_queue->hasSnapshotReads()) {
+            QString name = m_queue->takeNextSnapshotRead();
+            qDebug() << "Answering" << name << "from our snapshot, a download is in progress.";
+            replyToPendingRead(name, QVariantList() << m_readSnapshot.value(name));
+        }
+        Q_EMIT queueChanged();
+        return;
+    }
+
+    if (m_status != static_cast<uint>(Status::Idle) || m_queue->isEmpty()) {
+        // Either busy, or someone else got here first.
+        return;
+    }
+
+    OperationQueue::Task task = m_queue->takeNext(&m_runningAccess, &m_runningOperationId, &m_runningOperationName);
+    m_runningOperationTimer.start();
+
+    // A cancellation of whatever ran before must not leak into this one.
+    m_callbacks->clearAbort();
+    setStatus(Status::Processing);
+    task();
+}
+
+void ZyppBackend::cancelOperation(const QByteArray &operationId)
+{
+    CHECK_DBUS_CALLER_VOID
+
+    // Coalesced readers share one operation: a caller only lets go of its own calls, and the operation
+    // goes away with the last of them.
+    QString name = operationId.isEmpty() ? QString() :
+                   operationId == m_runningOperationId ? m_runningOperationName : m_queue->name(operationId);
+    if (!name.isEmpty() && m_pendingReads.contains(name)) {
+        if (!detachPendingRead(name, request.service())) {
+            sendErrorReply(Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()),
+                           QStringLiteral("The operation is shared with other callers, and only they can cancel it."));
+            return;
+        }
+        if (m_pendingReads.contains(name)) {
+            qDebug() << "Detached" << request.service() << "from" << name << ", others are still waiting for it.";
+            return;
+        }
+    }
+
+    // Not queued, obviously: it's about what is in the queue, or running.
+    if (m_queue->cancel(operationId)) {
+        qDebug() << "Cancelled queued operation" << operationId;
+        Q_EMIT queueChanged();
+        return;
+    }
+
+    if (operationId.isEmpty() || operationId != m_runningOperationId) {
+        sendErrorReply(QDBusError::errorString(QDBusError::InvalidArgs), QStringLiteral("No such operation."));
+        return;
+    }
+
+    if (m_transactionInZygote) {
+        sendErrorReply(Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()),
+                       QStringLiteral("The operation can not be cancelled while it is running."));
+        return;
+    }
+
+    // Once rpm started modifying the system, stopping halfway would leave it in a worse state than either end.
+    // The commit takes the same flag right before starting rpm: either it sees this, or this fails.
+    if (!m_callbacks->requestAbort()) {
+        sendErrorReply(Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()),
+                       QStringLiteral("The operation is already modifying the system, and can not be cancelled anymore."));
+        return;
+    }
+
+    qDebug() << "Cancelling running operation" << operationId;
+    // Downloads give up at their next callback, everything else before its next blocking step.
+    if (m_transactionPid > 0) {
+        // Zygote mode: the flag that matters lives in the transaction process. Should its pid be still on
+        // its way, it gets the signal as soon as we know it.
+        ::kill(m_transactionPid, SIGUSR1);
+    }
+}
+
+Hemera::Operation *ZyppBackend::runTransaction(const TransactionRequest &transaction, QObject *parent)
+{
+    if (ZyppZygote::channel() >= 0) {
+        return new ZyppZygoteOperation(this, transaction, parent);
+    }
+
+    return new ZyppExecutorOperation(this, [this, transaction] (QString &errorName, QString &errorMessage, QByteArray &result) {
+        return m_runner->run(transaction, errorName, errorMessage, result);
+    }, parent);
+}
+
+void ZyppBackend::setProgress(int percent, int rate)
+{
+    m_progressPercent = percent;
+    m_progressRate = rate;
+    Q_EMIT progressChanged();
+}
+
+void ZyppBackend::setProgressCurrentStep(uint step)
+{
+    m_progressCurrentStep = step;
+    if (m_progressPercent != 0 || m_progressRate != 0) {
+        m_progressPercent = 0;
+        m_progressRate = 0;
+        Q_EMIT progressChanged();
+    }
+
+    Q_EMIT progressCurrentStepChanged();
+}
+
+void ZyppBackend::runOnExecutor(const std::function<void ()> &work, const std::function<void ()> &done)
+{
+    QFutureWatcher<void> *watcher = new QFutureWatcher<void>(this);
+    connect(watcher, &QFutureWatcher<void>::finished, this, [watcher, done] {
+        watcher->deleteLater();
+        done();
+    });
+    watcher->setFuture(QtConcurrent::run(m_executor, work));
+}
+
+void ZyppBackend::takeReadSnapshot(const std::function<void ()> &then)
+{
+    ApplicationIndex::Snapshot applications = m_applications->snapshot();
+    QSharedPointer< QHash< QString, QByteArray > > snapshot(new QHash< QString, QByteArray >);
+    runOnExecutor([this, applications, snapshot] {
+        // Make sure the installed set is current. Repositories are not needed, so don't even look at them.
+        m_pool->loadTarget();
+
+        snapshot->insert(QStringLiteral("listInstalledApplications"), installedApplicationsJson(applications));
+        snapshot->insert(QStringLiteral("listRepositories"), repositoriesJson());
+    }, [this, snapshot, then] {
+        m_readSnapshot = *snapshot;
+        // Whoever came in meanwhile can be answered now.
+        QMetaObject::invokeMethod(this, "dispatchOperation", Qt::QueuedConnection);
+        then();
+    });
+}
+
+QVariantMap ZyppBackend::queueStatistics() const
+{
+    QVariantMap statistics = m_queue->statistics();
+    statistics.insert(QStringLiteral("coalescedReads"), m_pendingReads.coalesced());
+    return statistics;
+}
+
+uint ZyppBackend::queueDepth() const
+{
+    return m_queue->size();
+}
+
+QString ZyppBackend::runningOperationType() const
+{
+    return m_runningOperationName;
+}
+
+QByteArray ZyppBackend::runningOperationId() const
+{
+    return m_runningOperationId;
+}
+
+QVariantList ZyppBackend::queuedOperations() const
+{
+    // The ids are what cancelOperation wants.
+    return m_queue->entries(m_runningOperationName, m_runningOperationName.isEmpty() ? 0 : m_runningOperationTimer.elapsed());
+}
+
+QVariantMap ZyppBackend::operationDurations() const
+{
+    return m_queue->meanDurations();
+}
+
+bool ZyppBackend::joinPendingRead(const QString &key, const QDBusMessage &request)
+{
+    return m_pendingReads.join(key, request);
+}
+
+void ZyppBackend::replyToPendingRead(const QString &key, const QVariantList &arguments)
+{
+    for (const QDBusMessage &request : m_pendingReads.take(key)) {
+        QDBusConnection::systemBus().send(request.createReply(arguments));
+    }
+}
+
+bool ZyppBackend::detachPendingRead(const QString &key, const QString &service)
+{
+    QList< QDBusMessage > detached = m_pendingReads.detach(key, service);
+    for (const QDBusMessage &request : detached) {
+        QDBusConnection::systemBus().send(request.createErrorReply(QStringLiteral(OPERATION_CANCELLED_ERROR),
+                                                                   QStringLiteral("The operation has been cancelled.")));
+    }
+
+    return !detached.isEmpty();
+}
+
+void ZyppBackend::replyErrorToPendingRead(const QString &key, const QString &errorName, const QString &errorMessage)
+{
+    for (const QDBusMessage &request : m_pendingReads.take(key)) {
+        QDBusConnection::systemBus().send(request.createErrorReply(errorName, errorMessage));
+    }
+}
+
+void ZyppBackend::noteIncomingRequest()
+{
+    if (m_lastRequest.isValid()) {
+        qint64 interval = m_lastRequest.elapsed();
+        if (m_meanRequestInterval < 0) {
+            m_meanRequestInterval = interval;
+        } else {
+            m_meanRequestInterval = (1 - IDLE_TIMEOUT_SMOOTHING) * m_meanRequestInterval + IDLE_TIMEOUT_SMOOTHING * interval;
+        }
+    }
+
+    m_lastRequest.start();
+}
+
+void ZyppBackend::armTimebomb()
+{
+    int timeout;
+    if (!m_preparedUpdateHandle.isEmpty()) {
+        // A prepared update lives in our pool only: wait for its commit as long as we reasonably can.
+        timeout = IDLE_TIMEOUT_MAX_MSECS;
+    } else if (m_memoryPressure) {
+        // Get out of the way as soon as possible.
+        timeout = IDLE_TIMEOUT_MEMORY_PRESSURE_MSECS;
+    } else if (m_meanRequestInterval < 0) {
+        // We have no idea about the traffic yet.
+        timeout = IDLE_TIMEOUT_DEFAULT_MSECS;
+    } else {
+        qint64 expectedNextRequest = m_meanRequestInterval * IDLE_TIMEOUT_INTERVAL_FACTOR;
+        if (expectedNextRequest > IDLE_TIMEOUT_MAX_MSECS) {
+            // Requests are sparse, waiting is pointless.
+            timeout = IDLE_TIMEOUT_MIN_MSECS;
+        } else {
+            timeout = qMax(static_cast<qint64>(IDLE_TIMEOUT_MIN_MSECS), expectedNextRequest);
+        }
+    }
+
+    qDebug() << "Starting our idle timebomb, exploding in" << timeout << "msecs.";
+    if (timeout != m_timebomb->interval()) {
+        m_timebomb->setInterval(timeout);
+        Q_EMIT idleTimeoutChanged();
+    }
+    m_timebomb->start();
+}
+
+uint ZyppBackend::idleTimeout() const
+{
+    return m_timebomb->interval();
+}
+
+bool ZyppBackend::memoryPressure() const
+{
+    return m_memoryPressure;
+}
+
+void ZyppBackend::setMemoryPressure(bool memoryPressure)
+{
+    CHECK_DBUS_CALLER_VOID
+
+    if (memoryPressure == m_memoryPressure) {
+        return;
+    }
+
+    m_memoryPressure = memoryPressure;
+    Q_EMIT idleTimeoutChanged();
+
+    // Reconsider a ticking timebomb right away
+    if (m_timebomb->isActive()) {
+        armTimebomb();
     }
 }
 
@@ -404,10 +605,31 @@ int ZyppBackend::progressRate() const
 
 void ZyppBackend::initImpl()
 {
-    // Set our timebomb in 15 seconds.
-    m_timebomb->setInterval(15 * 1000);
+    // Our timebomb adapts to the traffic, see armTimebomb.
+    m_timebomb->setInterval(IDLE_TIMEOUT_DEFAULT_MSECS);
     m_timebomb->setSingleShot(true);
-    connect(m_timebomb, &QTimer::timeout, this, &ZyppBackend::explode);
+    connect(m_timebomb, &QTimer::timeout, this, [this] {
+        // Leave a snapshot behind, so that the next start is cheap. Whatever comes in meanwhile waits in the queue.
+        setStatus(Status::Processing);
+        runOnExecutor([this] {
+            m_pool->writeSnapshot();
+        }, [this] {
+            if (!m_queue->isEmpty()) {
+                // Someone came in meanwhile: serve them, the timebomb is armed again once we're done.
+                qDebug() << "Requests came in while writing the pool snapshot, not exploding.";
+                setStatus(Status::Idle);
+                return;
+            }
+
+            Q_EMIT explode();
+        });
+    });
+
+    // Time each phase of the startup, so that cold start regressions are easy to spot.
+    QElapsedTimer initTimer;
+    initTimer.start();
+    QElapsedTimer phaseTimer;
+    phaseTimer.start();
 
     try {
         m_zypp = zypp::getZYpp();
@@ -421,12 +643,23 @@ void ZyppBackend::initImpl()
         return;
     }
 
-    m_zypp->initializeTarget("/");
-    m_zypp->target()->load();
+    recordStartupPhase(QStringLiteral("zypp"), phaseTimer.restart());
+
+    // The pool stays resident from now on.
+    m_pool = new PoolManager(m_zypp);
+
+    // Whatever we resolved last time might still hold.
+    m_applicationUpdates.load();
+
+    // Scanned on first use, watched from then on.
+    m_applications = new ApplicationIndex(StaticConfig::hemeraServicesPath(), this);
 
     // Connect the callbacks
     m_callbacks = new CallbacksManager(this);
 
+    // Transactions run on the executor, unless there's a zygote to take them.
+    m_runner = new TransactionRunner(m_zypp, m_pool, m_callbacks);
+
     // Bring up the bus!
     if (!QDBusConnection::systemBus().registerObject(BACKEND_PATH, this)) {
         setInitError(Hemera::Literals::literal(Hemera::Literals::Errors::registerObjectFailed()),
@@ -441,359 +674,420 @@ void ZyppBackend::initImpl()
 
     new BackendAdaptor(this);
 
-    // Make the backend ready and ignite the timebomb
-    setStatus(Status::Idle);
+    recordStartupPhase(QStringLiteral("bus"), phaseTimer.restart());
 
-    setReady();
-}
+    // We're on the bus already: load the target in the background. Incoming calls wait until we're Idle.
+    setStatus(Status::Loading);
 
-int ZyppBackend::configureCallbacksManager(zypp::sat::Transaction transaction)
-{
-    // Iterate each step to find out the real transaction size.
-    quint64 items = 0;
-    quint64 downloadSize = 0;
-    for (zypp::sat::Transaction::const_iterator it = transaction.begin(); it != transaction.end(); ++it) {
-        zypp::sat::Transaction::Step step = *it;
-        if (step.stepType() == zypp::sat::Transaction::TRANSACTION_IGNORE) {
-            // Ignore steps are not interesting for our callbacks.
-            continue;
+    // Filled by the loader thread, and read only once it is done.
+    QSharedPointer<QVariantMap> loadTimings(new QVariantMap);
+
+    QFutureWatcher<QString> *loadWatcher = new QFutureWatcher<QString>(this);
+    connect(loadWatcher, &QFutureWatcher<QString>::finished, this, [this, loadWatcher, loadTimings, initTimer] {
+        QString error = loadWatcher->result();
+        loadWatcher->deleteLater();
+
+        for (QVariantMap::const_iterator it = loadTimings->constBegin(); it != loadTimings->constEnd(); ++it) {
+            recordStartupPhase(it.key(), it.value().toLongLong());
         }
+        recordStartupPhase(QStringLiteral("total"), initTimer.elapsed());
 
-        ++items;
-        zypp::ResObject::Ptr o(zypp::makeResObject(step.satSolvable()));
-        downloadSize += o->downloadSize();
-    }
+        if (!error.isEmpty()) {
+            qWarning() << "Could not load the target, giving up:" << error;
+            setStatus(Status::Failed);
+            Q_EMIT explode();
+            return;
+        }
+
+        QStringList phases;
+        for (QVariantMap::const_iterator it = m_startupTimings.constBegin(); it != m_startupTimings.constEnd(); ++it) {
+            phases.append(QStringLiteral("%1 %2ms").arg(it.key()).arg(it.value().toLongLong()));
+        }
+        sd_notifyf(0, "STATUS=Hemera SoftwareManager Zypp Worker is ready (%s)", phases.join(QStringLiteral(", ")).toLatin1().constData());
 
-    m_callbacks->setOperationType(CallbacksManager::OperationType::Package);
-    m_callbacks->setTotalItems(items, downloadSize);
+        // Make the backend ready and ignite the timebomb
+        setStatus(Status::Idle);
+    });
+    loadWatcher->setFuture(QtConcurrent::run(m_executor, [this, loadTimings] () -> QString {
+        try {
+            QElapsedTimer loadTimer;
+            loadTimer.start();
+            m_zypp->initializeTarget("/");
+            loadTimings->insert(QStringLiteral("target"), loadTimer.restart());
+            // Restore the pool from our snapshot if possible.
+            bool restored = m_pool->initialize();
+            loadTimings->insert(QStringLiteral("pool"), loadTimer.restart());
+            if (!restored) {
+                // Cold start: pay for the target and the repositories here, where it shows in the timings,
+                // rather than in whichever request comes first.
+                m_pool->preparePool();
+                loadTimings->insert(QStringLiteral("preparePool"), loadTimer.elapsed());
+            }
+        } catch (const zypp::Exception &excpt_r) {
+            ZYPP_CAUGHT (excpt_r);
+            return QString::fromStdString(excpt_r.asUserHistory());
+        }
 
-    qDebug() << "Callbacks have been configured for a transaction consisting of" << items << "items, and" << downloadSize << "bytes to be downloaded.";
-    zypp::sat::dumpOn(std::cout, m_zypp->resolver()->getTransaction());
+        return QString();
+    }));
 
-    return items;
+    setReady();
 }
 
-void ZyppBackend::resetCallbacksManager()
+void ZyppBackend::addRepository(const QString &name, const QStringList &urls)
 {
-    m_callbacks->setOperationType(CallbacksManager::OperationType::NoOperation);
-    qDebug() << "Callbacks reset and idling";
+    CHECK_DBUS_CALLER_VOID
+
+    setDelayedReply(true);
+
+    enqueueOperation(OperationQueue::Priority::Normal, OperationQueue::Access::Exclusive, request, QStringLiteral("addRepository"), [this, request, name, urls] {
+        TransactionRequest transaction;
+        transaction.type = TransactionRequest::Type::AddRepository;
+        transaction.alias = name;
+        transaction.urls = urls;
+        runRepositoryTransaction(transaction, request);
+    });
 }
 
-void ZyppBackend::addRepository(const QString &name, const QStringList &urls)
+void ZyppBackend::removeRepository(const QString &name)
 {
     CHECK_DBUS_CALLER_VOID
-    ENQUEUE_OPERATION
 
     setDelayedReply(true);
 
-    setStatus(Status::Processing);
+    enqueueOperation(OperationQueue::Priority::Normal, OperationQueue::Access::Exclusive, request, QStringLiteral("removeRepository"), [this, request, name] {
+        TransactionRequest transaction;
+        transaction.type = TransactionRequest::Type::RemoveRepository;
+        transaction.alias = name;
+        runRepositoryTransaction(transaction, request);
+    });
+}
 
-    if (addRepositoryInternal(name, urls, request)) {
-        QDBusConnection::systemBus().send(request.createReply());
-    }
+void ZyppBackend::runRepositoryTransaction(const TransactionRequest &transaction, const QDBusMessage &request)
+{
+    Hemera::Operation *op = runTransaction(transaction, this);
+    connect(op, &Hemera::Operation::finished, this, [this, op, request] {
+        invalidateApplicationUpdates();
+
+        // In zygote mode the configuration changed behind our repository manager's back. Pick it up before
+        // anyone else gets to the pool: it's cheap, so don't bother telling the two modes apart.
+        runOnExecutor([this] {
+            m_pool->reloadRepositories();
+        }, [this, op, request] {
+            if (!op->isError()) {
+                QDBusConnection::systemBus().send(request.createReply());
+            } else {
+                QDBusConnection::systemBus().send(request.createErrorReply(op->errorName(), op->errorMessage()));
+            }
 
-    setStatus(Status::Idle);
+            setStatus(Status::Idle);
+        });
+    });
 }
 
-bool ZyppBackend::addRepositoryInternal(const QString &alias, const QStringList &urls, const QDBusMessage &request)
+void ZyppBackend::refreshRepositories()
 {
-    zypp::RepoInfo repo;
+    CHECK_DBUS_CALLER_VOID
 
-    // Heuristics for determining which repository we are dealing with
-    // NOTE: Hemera uses only rpm-md repositories.
-    if (urls.size() > 1) {
-        // No doubts here.
-        repo.setType(zypp::repo::RepoType::RPMMD);
-        for (const QString &url : urls) {
-            zypp::Url zyppUrl(url.toStdString());
-            if (!zyppUrl.isValid()) {
-                if (request.type() == QDBusMessage::MethodCallMessage) {
-                    QDBusConnection::systemBus().send(request.createErrorReply(QDBusError::errorString(QDBusError::InvalidArgs), QStringLiteral("Invalid repo URL")));
-                }
-                return false;
-            }
-            repo.addBaseUrl(zyppUrl);
-        }
-    } else {
-        // Inspect the URL.
-        zypp::Url url(urls.first().toStdString());
-        if (!url.isValid()) {
-            if (request.type() == QDBusMessage::MethodCallMessage) {
-                QDBusConnection::systemBus().send(request.createErrorReply(QDBusError::errorString(QDBusError::InvalidArgs), QStringLiteral("Invalid repo URL")));
-            }
-            return false;
-        }
-        if (url.schemeIsLocal()) {
-            // It's a plain dir repository
-            repo.setType(zypp::repo::RepoType::RPMPLAINDIR);
-            // empty packages path would cause unwanted removal of installed rpms
-            // in current working directory (bnc #445504)
-            // OTOH packages path == ZYPPER_RPM_CACHE_DIR (the same as repo URI)
-            // causes cp file thesamefile, which fails silently. This may be worth
-            // fixing in libzypp.
-            repo.setPackagesPath("/tmp");
-        } else {
-            // It's an md repo
-            repo.setType(zypp::repo::RepoType::RPMMD);
-        }
-
-        // Add the URL
-        repo.addBaseUrl(url);
-    }
-
-    repo.setEnabled(true);
-    repo.setAutorefresh(true);
-    repo.setAlias(alias.toStdString());
-    repo.setName(alias.toStdString());
-    // Hemera's policy is to delete package from the cache to save space.
-    repo.setKeepPackages(false);
-
-    zypp::RepoManager manager;
-
-    try {
-        manager.addRepository(repo);
-    } catch (const zypp::repo::RepoAlreadyExistsException & e) {
-        // It's ok to be here
-        qWarning() << "Warning: the repo already exists";
-    /* We might, one day, care about more specialized exception handling, even if I don't think so.
-    } catch (const zypp::repo::RepoInvalidAliasException & e) {
-    } catch (const zypp::repo::RepoUnknownTypeException & e) {
-    } catch (const zypp::repo::RepoException & e) {
-    */
-    } catch (const zypp::Exception & e) {
-        if (request.type() == QDBusMessage::MethodCallMessage) {
-            QDBusConnection::systemBus().send(request.createErrorReply(QDBusError::errorString(QDBusError::InternalError), QString::fromStdString(e.asUserHistory())));
-        }
-        return false;
-    }
+    setDelayedReply(true);
 
-    return true;
+    enqueueOperation(OperationQueue::Priority::Background, OperationQueue::Access::Download, request, QStringLiteral("refreshRepositories"), [this, request] {
+        takeReadSnapshot([this, request] {
+            Hemera::Operation *op = new ZyppRefreshRepositoriesOperation(this, this);
+            connect(op, &Hemera::Operation::finished, this, [this, op] {
+                invalidateApplicationUpdates();
+                if (!op->isError()) {
+                    // Queued before we go Idle: resolve while the metadata is fresh, not when someone asks.
+                    precomputeApplicationUpdates();
+                }
+            });
+            HANDLE_OPERATION_DBUS(op)
+        });
+    });
 }
 
-
-void ZyppBackend::removeRepository(const QString &name)
+void ZyppBackend::downloadApplicationUpdates(const QByteArray &updates)
 {
     CHECK_DBUS_CALLER_VOID
-    ENQUEUE_OPERATION
 
     setDelayedReply(true);
 
-    setStatus(Status::Processing);
+    enqueueOperation(OperationQueue::Priority::Background, OperationQueue::Access::Download, request, QStringLiteral("downloadApplicationUpdates"), [this, request, updates] {
+        takeReadSnapshot([this, request, updates] {
+            using namespace Hemera::SoftwareManagement;
 
-    if (removeRepositoryInternal(name, request)) {
-        QDBusConnection::systemBus().send(request.createReply());
-    }
+            QStringList packages;
+            ApplicationUpdates applicationUpdates = Constructors::applicationUpdatesFromJson(QJsonDocument::fromJson(updates).array());
+            for (const ApplicationUpdate &update : applicationUpdates) {
+                packages.append(update.applicationId());
+            }
 
-    setStatus(Status::Idle);
+            m_progressAvailableSteps = static_cast<uint>(ProgressReporter::OperationStep::Download);
+            m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::UpdateSystem);
+            Hemera::Operation *op = new ZyppPackageOperation(this, packages, PackageOperation::Update, true, this);
+            HANDLE_OPERATION_DBUS(op)
+        });
+    });
 }
 
-bool ZyppBackend::removeRepositoryInternal(const QString &alias, const QDBusMessage &request)
+void ZyppBackend::updateApplications(const QByteArray &updates)
 {
-    zypp::RepoManager manager;
+    CHECK_DBUS_CALLER_VOID
 
-    try {
-        manager.removeRepository(manager.getRepo(alias.toStdString()));
-    } catch (const zypp::Exception & e) {
-        if (request.type() == QDBusMessage::MethodCallMessage) {
-            QDBusConnection::systemBus().send(request.createErrorReply(QDBusError::errorString(QDBusError::InternalError), QString::fromStdString(e.asUserHistory())));
+    setDelayedReply(true);
+
+    enqueueOperation(OperationQueue::Priority::Normal, OperationQueue::Access::Exclusive, request, QStringLiteral("updateApplications"), [this, request, updates] {
+        using namespace Hemera::SoftwareManagement;
+
+        QStringList packages;
+        ApplicationUpdates applicationUpdates = Constructors::applicationUpdatesFromJson(QJsonDocument::fromJson(updates).array());
+        for (const ApplicationUpdate &update : applicationUpdates) {
+            packages.append(update.applicationId());
         }
-        return false;
-    }
 
-    return true;
+        m_progressAvailableSteps = static_cast<uint>(ProgressReporter::OperationStep::Download | ProgressReporter::OperationStep::Process);
+        m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::UpdateApplications);
+        Hemera::Operation *op = new ZyppPackageOperation(this, packages, PackageOperation::Update, false, this);
+        HANDLE_OPERATION_DBUS(op)
+    });
 }
 
-void ZyppBackend::refreshRepositories()
+void ZyppBackend::updateSystem(const QString &updatePath)
 {
     CHECK_DBUS_CALLER_VOID
-    ENQUEUE_OPERATION
-
-    setStatus(Status::Processing);
 
-    // Delay our reply
     setDelayedReply(true);
 
-    Hemera::Operation *op = new ZyppRefreshRepositoriesOperation(m_zypp, this, m_callbacks, this);
-    HANDLE_OPERATION_DBUS(op)
+    enqueueOperation(OperationQueue::Priority::Normal, OperationQueue::Access::Exclusive, request, QStringLiteral("updateSystem"), [this, request, updatePath] {
+        // A one-shot update supersedes whatever was prepared.
+        discardPreparedUpdate();
+
+        commitSystemUpdate(request, updatePath, false);
+    });
 }
 
-void ZyppBackend::downloadApplicationUpdates(const QByteArray &updates)
+QByteArray ZyppBackend::prepareSystemUpdate(const QString &updatePath)
 {
-    CHECK_DBUS_CALLER_VOID
-    ENQUEUE_OPERATION
+    CHECK_DBUS_CALLER(QByteArray)
 
-    using namespace Hemera::SoftwareManagement;
+    setDelayedReply(true);
 
-    setStatus(Status::Processing);
+    // Everything but the rpm transaction, so that it can happen before the system goes read-write.
+    enqueueOperation(OperationQueue::Priority::Normal, OperationQueue::Access::Exclusive, request, QStringLiteral("prepareSystemUpdate"),
+                     [this, request, updatePath] {
+        // There's only room for one.
+        discardPreparedUpdate();
+
+        TransactionRequest transaction;
+        transaction.type = TransactionRequest::Type::LocalPackages;
+        transaction.path = updatePath;
+        transaction.upgrade = true;
+        transaction.prepareOnly = true;
+
+        QByteArray handle = m_runningOperationId;
+        Hemera::Operation *op = runTransaction(transaction, this);
+        connect(op, &Hemera::Operation::finished, this, [this, op, request, handle, updatePath] {
+            if (op->isError()) {
+                QDBusConnection::systemBus().send(request.createErrorReply(op->errorName(), op->errorMessage()));
+                setStatus(Status::Idle);
+                return;
+            }
 
-    // Delay our reply
-    setDelayedReply(true);
+            // The pool holds the resolved transaction from now on, until it gets committed or something else touches it.
+            m_preparedUpdateHandle = handle;
+            m_preparedUpdatePath = updatePath;
 
-    QStringList packages;
-    ApplicationUpdates applicationUpdates = Constructors::applicationUpdatesFromJson(QJsonDocument::fromJson(updates).array());
-    for (const ApplicationUpdate &update : applicationUpdates) {
-        packages.append(update.applicationId());
-    }
+            qDebug() << "System update" << m_preparedUpdateHandle << "prepared.";
+            QDBusConnection::systemBus().send(request.createReply(QVariantList() << m_preparedUpdateHandle));
+            setStatus(Status::Idle);
+        });
+    });
 
-    m_progressAvailableSteps = static_cast<uint>(ProgressReporter::OperationStep::Download);
-    m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::UpdateSystem);
-    Hemera::Operation *op = new ZyppPackageOperation(m_zypp, this, packages, PackageOperation::Update, true, this);
-    HANDLE_OPERATION_DBUS(op)
+    return QByteArray();
 }
 
-void ZyppBackend::updateApplications(const QByteArray &updates)
+void ZyppBackend::commitPreparedUpdate(const QByteArray &handle)
 {
     CHECK_DBUS_CALLER_VOID
-    ENQUEUE_OPERATION
 
-    using namespace Hemera::SoftwareManagement;
-
-    setStatus(Status::Processing);
+    if (handle.isEmpty() || handle != m_preparedUpdateHandle) {
+        // Never prepared, superseded, or we have been restarted meanwhile.
+        sendErrorReply(QDBusError::errorString(QDBusError::InvalidArgs), QStringLiteral("No such prepared update."));
+        return;
+    }
 
-    // Delay our reply
     setDelayedReply(true);
 
-    QStringList packages;
-    ApplicationUpdates applicationUpdates = Constructors::applicationUpdatesFromJson(QJsonDocument::fromJson(updates).array());
-    for (const ApplicationUpdate &update : applicationUpdates) {
-        packages.append(update.applicationId());
-    }
+    // The system is most likely read-write and waiting for us: skip the line.
+    enqueueOperation(OperationQueue::Priority::Interactive, OperationQueue::Access::Exclusive, request, QStringLiteral("commitPreparedUpdate"),
+                     [this, request, handle] {
+        if (handle != m_preparedUpdateHandle) {
+            QDBusConnection::systemBus().send(request.createErrorReply(QDBusError::errorString(QDBusError::InvalidArgs),
+                                                                       QStringLiteral("The prepared update has been superseded.")));
+            setStatus(Status::Idle);
+            return;
+        }
+
+        // From here on, it's the transaction's. Should the pool not hold it anymore, it gets prepared again.
+        QString updatePath = m_preparedUpdatePath;
+        m_preparedUpdateHandle = QByteArray();
+        m_preparedUpdatePath.clear();
 
-    m_progressAvailableSteps = static_cast<uint>(ProgressReporter::OperationStep::Download | ProgressReporter::OperationStep::Process);
-    m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::UpdateApplications);
-    Hemera::Operation *op = new ZyppPackageOperation(m_zypp, this, packages, PackageOperation::Update, false, this);
+        commitSystemUpdate(request, updatePath, true);
+    });
+}
+
+void ZyppBackend::commitSystemUpdate(const QDBusMessage &request, const QString &updatePath, bool prepared)
+{
+    TransactionRequest transaction;
+    transaction.type = TransactionRequest::Type::LocalPackages;
+    transaction.path = updatePath;
+    transaction.upgrade = true;
+    transaction.prepared = prepared;
+
+    m_progressAvailableSteps = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationStep::Process);
+    m_progressOperationType = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationType::UpdateSystem);
+    ZyppCommitOperation *op = new ZyppCommitOperation(this, transaction, this);
     HANDLE_OPERATION_DBUS(op)
 }
 
-zypp::RepoManager *ZyppBackend::prepareLocalRepositoryTransaction(const QString &updatePath, bool force)
+void ZyppBackend::discardPreparedUpdate()
 {
-    QDir packagesDir(updatePath);
-    QStringList installPackages;
-    for (const QFileInfo &package : packagesDir.entryInfoList(QStringList() << QStringLiteral("*.rpm"))) {
-        using zypp::target::rpm::RpmHeader;
-        // rpm header (need name-version-release)
-        RpmHeader::constPtr header =
-            RpmHeader::readPackage(package.absoluteFilePath().toStdString(), RpmHeader::NOSIGNATURE);
-        if (header) {
-            qDebug() << "Going to install package " << header->tag_name().c_str() << header->tag_edition().asString().c_str();
-            installPackages << QString::fromStdString(header->tag_name());
-        } else {
-            sendErrorReply(QDBusError::errorString(QDBusError::InternalError),
-                            QStringLiteral("Contents of the package appear to be corrupted or invalid."));
-            setStatus(Status::Idle);
-            return nullptr;
-        }
+    if (m_preparedUpdateHandle.isEmpty()) {
+        return;
     }
 
-    // add a plaindir repo
-    if (!addRepositoryInternal(QLatin1String(TMP_RPM_REPO_ALIAS), QStringList() << QString::fromLatin1("dir://%1").arg(updatePath))) {
-        sendErrorReply(QDBusError::errorString(QDBusError::InternalError), QStringLiteral("Could not create temporary repository"));
-        setStatus(Status::Idle);
-        return nullptr;
-    }
+    // Whatever it left in the pool goes away with the next preparation.
+    qDebug() << "Discarding prepared update" << m_preparedUpdateHandle;
+    m_preparedUpdateHandle = QByteArray();
+    m_preparedUpdatePath.clear();
+}
 
-    zypp::RepoManager *manager = new zypp::RepoManager;
-    zypp::RepoInfo repo;
+QByteArray ZyppBackend::listUpdates()
+{
+    CHECK_DBUS_CALLER(QByteArray)
 
-    try {
-        repo = manager->getRepo(TMP_RPM_REPO_ALIAS);
-        manager->refreshMetadata(repo, zypp::RepoManager::RefreshIfNeeded);
-        manager->buildCache(repo);
-    } catch (const zypp::Exception & e) {
-        sendErrorReply(QDBusError::errorString(QDBusError::InternalError), QStringLiteral("Could not load temporary repository"));
-        qWarning() << "Warning: could not load temporary repository!" << updatePath << QString::fromStdString(e.asString());
-        if (!removeRepositoryInternal(QString::fromStdString(repo.alias()))) {
-            qWarning() << "Warning: could not remove temporary repository!" << updatePath;
-        }
-        setStatus(Status::Idle);
-        return nullptr;
+    QByteArray applicationUpdates;
+    if (m_status == static_cast<uint>(Status::Idle) && cachedApplicationUpdates(applicationUpdates)) {
+        // Nothing changed since we last resolved: no need for the queue, nor for the solver.
+        armTimebomb();
+        return applicationUpdates;
     }
 
-    zypp_prepare_pool(m_zypp, manager);
-
-    // tell the solver what we want
-    std::list< zypp::RepoInfo > repos;
-    repos.insert(repos.begin(), repo);
+    setDelayedReply(true);
 
-    // Mark packages for installation
-    for (const QString &package : installPackages) {
-        markPackage(repos, package.toStdString(), PackageOperation::InstallOrUpdate, force);
+    if (joinPendingRead(QStringLiteral("listUpdates"), request)) {
+        // The same question is on its way already, our caller will get the same answer.
+        return QByteArray();
     }
-    // Package removal?
-    if (QFile::exists(QStringLiteral("%1%2remove.json").arg(packagesDir.path(), QDir::separator()))) {
-        QFile removePackages(QStringLiteral("%1%2remove.json").arg(packagesDir.path(), QDir::separator()));
-        if (!removePackages.open(QIODevice::ReadOnly | QIODevice::Text)) {
-            sendErrorReply(QDBusError::errorString(QDBusError::InternalError),
-                            QStringLiteral("Contents of the package appear to be corrupted or invalid."));
-            if (!removeRepositoryInternal(QString::fromStdString(repo.alias()))) {
-                qWarning() << "Warning: could not remove temporary repository!";
+
+    enqueueOperation(OperationQueue::Priority::Interactive, OperationQueue::Access::Exclusive, request, QStringLiteral("listUpdates"), [this] {
+        lookupApplicationUpdates(false, [this] (bool success, const QByteArray &applicationUpdates, bool) {
+            if (!success) {
+                replyErrorToPendingRead(QStringLiteral("listUpdates"), QDBusError::errorString(QDBusError::InternalError), QStringLiteral("Could not resolve the pool"));
+
+                setStatus(Status::Idle);
+                return;
             }
-            setStatus(Status::Idle);
-            return nullptr;
-        }
 
-        QJsonObject rp = QJsonDocument::fromJson(removePackages.readAll()).object();
+            // Send reply
+            replyToPendingRead(QStringLiteral("listUpdates"), QVariantList() << applicationUpdates);
 
-        for (const QVariant &package : rp.value(QStringLiteral("removePackages")).toArray().toVariantList()) {
-            markPackage(repos, package.toString().toStdString(), PackageOperation::Remove, force);
-        }
-    }
+            // Done.
+            setStatus(Status::Idle);
+        });
+    });
 
-    return manager;
+    return QByteArray();
 }
 
-void ZyppBackend::updateSystem(const QString &updatePath)
+QByteArray ZyppBackend::listProvisionalUpdates(QString &mode)
 {
-    CHECK_DBUS_CALLER_VOID
-    ENQUEUE_OPERATION
+    CHECK_DBUS_CALLER(QByteArray)
 
-    setStatus(Status::Processing);
+    QByteArray applicationUpdates;
+    if (m_status == static_cast<uint>(Status::Idle) && cachedApplicationUpdates(applicationUpdates)) {
+        // Nothing changed since we last resolved: no need for the queue, nor for the solver.
+        armTimebomb();
+        mode = QStringLiteral(UPDATES_MODE_VERIFIED);
+        return applicationUpdates;
+    }
 
-    // Delay our reply
     setDelayedReply(true);
 
-    // Add packages
-    zypp::RepoManager *manager = prepareLocalRepositoryTransaction(updatePath);
-
-    if (!manager) {
-        qWarning() << "Could not prepare local repository transaction!";
-        QDBusConnection::systemBus().send(request.createErrorReply(QDBusError::errorString(QDBusError::InternalError),
-                                                                   QStringLiteral("Could not prepare local repository transaction!")));
-        return;
+    if (joinPendingRead(QStringLiteral("listProvisionalUpdates"), request)) {
+        // The same question is on its way already, our caller will get the same answer.
+        return QByteArray();
     }
 
-    // Set resolver options
-    m_zypp->resolver()->setUpgradeMode(true);
-    // Create our commit policy
-    zypp::ZYppCommitPolicy policy;
-    policy = policy.rpmExcludeDocs(true);
+    enqueueOperation(OperationQueue::Priority::Interactive, OperationQueue::Access::Exclusive, request, QStringLiteral("listProvisionalUpdates"), [this] {
+        lookupApplicationUpdates(true, [this] (bool success, const QByteArray &applicationUpdates, bool verified) {
+            if (!success) {
+                replyErrorToPendingRead(QStringLiteral("listProvisionalUpdates"), QDBusError::errorString(QDBusError::InternalError), QStringLiteral("Could not resolve the pool"));
+            } else if (verified) {
+                qDebug() << "Precomputed update list still holds.";
+                replyToPendingRead(QStringLiteral("listProvisionalUpdates"), QVariantList() << applicationUpdates << QStringLiteral(UPDATES_MODE_VERIFIED));
+            } else {
+                // Answer right away with what the pool says, and let the solver confirm it when there's time.
+                // Whoever cares gets applicationUpdatesChanged if the verified list turns out to be different.
+                replyToPendingRead(QStringLiteral("listProvisionalUpdates"), QVariantList() << applicationUpdates << QStringLiteral(UPDATES_MODE_PROVISIONAL));
+                m_applicationUpdates.noteProvisionalServed();
+                precomputeApplicationUpdates();
+            }
 
-    m_progressAvailableSteps = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationStep::Process);
-    m_progressOperationType = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationType::UpdateSystem);
-    Hemera::Operation *op = new ZyppCommitOperation(m_zypp, this, manager, policy, this);
-    HANDLE_OPERATION_DBUS(op)
-    connect(op, &Hemera::Operation::finished, [this, manager] {
-        // We remove our repo, before being done with this.
-        if (!removeRepositoryInternal(QString::fromStdString(manager->getRepo(TMP_RPM_REPO_ALIAS).alias()))) {
-            qWarning() << "Warning: could not remove temporary repository!";
-        }
-        delete manager;
+            // Done.
+            setStatus(Status::Idle);
+        });
     });
+
+    return QByteArray();
 }
 
-QByteArray ZyppBackend::listUpdates()
+QByteArray ZyppBackend::refreshRepositoriesAndListUpdates()
 {
     CHECK_DBUS_CALLER(QByteArray)
-    ENQUEUE_OPERATION
 
-    setStatus(Status::Processing);
-
-    // Always delay our reply.
     setDelayedReply(true);
 
-    zypp::RepoManager manager;
+    if (joinPendingRead(QStringLiteral("refreshRepositoriesAndListUpdates"), request)) {
+        // A check is on its way already, our caller will get the same answer.
+        return QByteArray();
+    }
+
+    // Refresh and listing on the same pool, in the same process lifetime: nothing can sneak in between them.
+    enqueueOperation(OperationQueue::Priority::Background, OperationQueue::Access::Download, request,
+                     QStringLiteral("refreshRepositoriesAndListUpdates"), [this] {
+        takeReadSnapshot([this] {
+            Hemera::Operation *op = new ZyppRefreshRepositoriesOperation(this, this);
+            connect(op, &Hemera::Operation::finished, this, [this, op] {
+                invalidateApplicationUpdates();
+                if (op->isError()) {
+                    replyErrorToPendingRead(QStringLiteral("refreshRepositoriesAndListUpdates"), op->errorName(), op->errorMessage());
+                    setStatus(Status::Idle);
+                    return;
+                }
+
+                // Only the repositories whose cache was rebuilt get reloaded, the rest of the pool stays.
+                lookupApplicationUpdates(false, [this] (bool success, const QByteArray &applicationUpdates, bool) {
+                    if (success) {
+                        replyToPendingRead(QStringLiteral("refreshRepositoriesAndListUpdates"), QVariantList() << applicationUpdates);
+                    } else {
+                        replyErrorToPendingRead(QStringLiteral("refreshRepositoriesAndListUpdates"), QDBusError::errorString(QDBusError::InternalError),
+                                                QStringLiteral("Could not resolve the pool"));
+                    }
 
-    zypp_prepare_pool(m_zypp, &manager);
+                    setStatus(Status::Idle);
+                });
+            });
+        });
+    });
+
+    return QByteArray();
+}
+
+bool ZyppBackend::resolveApplicationUpdates(const ApplicationIndex::Snapshot &applications, QByteArray &applicationUpdatesJson)
+{
+    m_pool->preparePool();
 
     // Set resolver options
     m_zypp->resolver()->setUpgradeMode(false);
@@ -801,12 +1095,7 @@ QByteArray ZyppBackend::listUpdates()
     qDebug() << "Invoking the solver!";
     if (!m_zypp->resolver()->resolvePool()) {
         qWarning() << "Could not resolve the pool!";
-
-        QDBusMessage reply = request.createErrorReply(QDBusError::errorString(QDBusError::InternalError), QStringLiteral("Could not resolve the pool"));
-        QDBusConnection::systemBus().send(reply);
-
-        setStatus(Status::Idle);
-        return QByteArray();
+        return false;
     }
 
     // If we got here, we're ready to list.
@@ -816,16 +1105,6 @@ QByteArray ZyppBackend::listUpdates()
     // We have a special ha- prefix for hemera application packages
     std::string hemeraAppPrefix = "ha-";
 
-    // Cache applicationIds to be matched
-    QHash< QString, QString > trimmedIds;
-    QDir hemeraServices(StaticConfig::hemeraServicesPath());
-    hemeraServices.setFilter(QDir::Files | QDir::NoSymLinks);
-    for (const QFileInfo &file : hemeraServices.entryInfoList(QStringList() << QStringLiteral("*.ha"))) {
-        QString trimmed = file.completeBaseName();
-        trimmed.remove(QLatin1Char('.'));
-        trimmedIds.insert(trimmed, file.completeBaseName());
-    }
-
     // Cache app updates
     Hemera::SoftwareManagement::ApplicationUpdates applicationUpdates;
 
@@ -843,38 +1122,16 @@ QByteArray ZyppBackend::listUpdates()
             if (std::equal(hemeraAppPrefix.begin(), hemeraAppPrefix.end(), res->name().begin())) {
                 // Verify the existence of the corresponding application in the system
                 QString packageName = QString::fromStdString(res->name());
-                QString trimmedPackageName = packageName.right(packageName.length() - 3);
-                trimmedPackageName.remove(QLatin1Char('.'));
+                QString applicationId = applications.applicationIdForPackage(packageName);
 
-                if (trimmedIds.contains(trimmedPackageName)) {
-                    qDebug() << "Found application update for " << packageName << ", applicationId is" << trimmedIds.value(trimmedPackageName);
+                if (!applicationId.isEmpty()) {
+                    qDebug() << "Found application update for " << packageName << ", applicationId is" << applicationId;
                 } else {
                     qWarning() << "Found an update for" << packageName << ", but no matching application id has been found. This is quite strange. Skipping...";
                 }
 
                 // It's a hemera application. Construct the update.
-                // Get the installed package first of all.
-                zypp::ui::Selectable::constPtr s = zypp::ui::Selectable::get(res->kind(), res->name());
-                zypp::ResObject::constPtr installed;
-                if (s->hasInstalledObj()) {
-                    installed = s->installedObj().resolvable();
-                }
-
-                using namespace Hemera::SoftwareManagement;
-
-                ApplicationUpdate update = Constructors::applicationUpdateFromData(trimmedIds.value(trimmedPackageName),
-                                                 QString::fromStdString(res->summary()),
-                                                 QString::fromStdString(res->description()),
-                                                 QString::fromStdString(installed->edition().asString()),
-                                                 QString::fromStdString(res->edition().asString()),
-                                                 res->downloadSize(),
-                                                 // Compute installed size (for the update only)
-                                                 s->hasInstalledObj() ? res->installSize().blocks(zypp::ByteCount::B) - installed->installSize().blocks(zypp::ByteCount::B)
-                                                                      : res->installSize().blocks(zypp::ByteCount::B),
-                                                 // TODO: How to handle changelog?
-                                                 QString());
-
-                applicationUpdates.append(update);
+                applicationUpdates.append(applicationUpdateFromPackages(applicationId, res, zypp::ui::Selectable::get(res->kind(), res->name())));
             }
         }
     }
@@ -884,198 +1141,401 @@ QByteArray ZyppBackend::listUpdates()
     m_zypp->resolver()->undo();
     m_zypp->resolver()->reset();
 
-    // Send reply
-    QDBusMessage reply = request.createReply(QVariantList() << QJsonDocument(Hemera::SoftwareManagement::Constructors::toJson(applicationUpdates)).toJson(QJsonDocument::Compact));
-    QDBusConnection::systemBus().send(reply);
+    applicationUpdatesJson = QJsonDocument(Hemera::SoftwareManagement::Constructors::toJson(applicationUpdates)).toJson(QJsonDocument::Compact);
+    return true;
+}
 
-    // Done.
-    setStatus(Status::Idle);
+QByteArray ZyppBackend::provisionalApplicationUpdates(const ApplicationIndex::Snapshot &applications)
+{
+    // No solver: an application has an update if something newer than what is installed is available.
+    // Whether it can actually be installed is up to the solver to say.
+    Hemera::SoftwareManagement::ApplicationUpdates applicationUpdates;
+    for (const ApplicationIndex::Application &application : applications.applications()) {
+        zypp::ui::Selectable::Ptr s = m_pool->packageSelectable(application.packageName.toStdString());
+        if (!s || !s->hasInstalledObj()) {
+            continue;
+        }
 
-    // Who cares
-    return QByteArray();
+        zypp::PoolItem candidate = s->updateCandidateObj();
+        if (candidate) {
+            applicationUpdates.append(applicationUpdateFromPackages(application.applicationId, candidate.resolvable(), s));
+        }
+    }
+
+    qDebug() << "Found" << applicationUpdates.size() << "provisional updates.";
+    return QJsonDocument(Hemera::SoftwareManagement::Constructors::toJson(applicationUpdates)).toJson(QJsonDocument::Compact);
 }
 
-void ZyppBackend::installApplications(const QByteArray &applications)
+QByteArray ZyppBackend::applicationUpdatesKey(const ApplicationIndex::Snapshot &applications) const
 {
-    CHECK_DBUS_CALLER_VOID
-    ENQUEUE_OPERATION
+    // The files' own mtimes: editing one in place leaves the directory alone.
+    return ApplicationUpdatesCache::key(m_pool->stateFingerprint(), applications.fingerprint());
+}
 
-    using namespace Hemera::SoftwareManagement;
+bool ZyppBackend::cachedApplicationUpdates(QByteArray &applicationUpdatesJson)
+{
+    // Only a verified list can be told from here: checking the full key reads the pool, and that is the executor's.
+    if (!m_applicationUpdates.isVerified() ||
+        !m_applicationUpdates.lookup(PoolManager::rpmdbCookie(), m_applications->snapshot().fingerprint(), applicationUpdatesJson)) {
+        return false;
+    }
 
-    setStatus(Status::Processing);
+    ++m_applicationUpdatesHits;
+    return true;
+}
 
-    setDelayedReply(true);
+void ZyppBackend::lookupApplicationUpdates(bool provisional, const ApplicationUpdatesLookup &done)
+{
+    QByteArray applicationUpdates;
+    if (cachedApplicationUpdates(applicationUpdates)) {
+        done(true, applicationUpdates, true);
+        return;
+    }
+
+    struct Lookup {
+        Lookup() : success(false), hit(false), provisional(false) {}
+        bool success;
+        bool hit;
+        bool provisional;
+        QByteArray key;
+        QByteArray cookie;
+        QByteArray applicationUpdates;
+    };
+    QSharedPointer< Lookup > lookup(new Lookup);
+    QByteArray knownKey = m_applicationUpdates.key();
+    ApplicationIndex::Snapshot applications = m_applications->snapshot();
+
+    runOnExecutor([this, provisional, knownKey, applications, lookup] {
+        // Taken first: should the installed set change while we're at it, the next lookup won't trust what we found.
+        lookup->cookie = PoolManager::rpmdbCookie();
+        if (!knownKey.isEmpty() && !lookup->cookie.isEmpty()) {
+            // Just loaded, or invalidated: only the full key can tell. This reads every repository's metadata status.
+            lookup->key = applicationUpdatesKey(applications);
+            if (lookup->key == knownKey) {
+                lookup->hit = true;
+                lookup->success = true;
+                return;
+            }
+        }
+
+        if (provisional && m_pool->hasLoadedRepositories()) {
+            // Straight from what the pool holds already. Loading repositories is for the solver to do, afterwards.
+            lookup->applicationUpdates = provisionalApplicationUpdates(applications);
+            lookup->provisional = true;
+            lookup->success = true;
+        } else {
+            // Nothing to tell an update from yet: the solver it is, right away.
+            lookup->success = resolveApplicationUpdates(applications, lookup->applicationUpdates);
+            lookup->key = applicationUpdatesKey(applications);
+        }
+    }, [this, applications, lookup, done] {
+        if (lookup->hit) {
+            ++m_applicationUpdatesHits;
+            m_applicationUpdates.confirm(lookup->cookie, applications.fingerprint());
+            done(true, m_applicationUpdates.applicationUpdates(), true);
+            return;
+        }
+
+        ++m_applicationUpdatesMisses;
+        if (!lookup->success) {
+            done(false, QByteArray(), false);
+        } else if (lookup->provisional) {
+            // Nothing to keep: only the solver's word goes into the cache.
+            done(true, lookup->applicationUpdates, false);
+        } else {
+            // A provisional list might have gone out meanwhile: make sure whoever got it hears about the verified one.
+            if (m_applicationUpdates.store(lookup->applicationUpdates, lookup->key, lookup->cookie, applications.fingerprint())) {
+                Q_EMIT applicationUpdatesChanged(m_applicationUpdates.applicationUpdates());
+            }
+            done(true, m_applicationUpdates.applicationUpdates(), true);
+        }
+    });
+}
 
-    QStringList packages;
-    ApplicationPackages applicationPackages = Constructors::applicationPackagesFromJson(QJsonDocument::fromJson(applications).array());
-    for (const ApplicationPackage &package : applicationPackages) {
-        packages.append(package.applicationId());
+void ZyppBackend::invalidateApplicationUpdates()
+{
+    // The list stays around: it might turn out to be still good, and tells whether the next one changed.
+    m_applicationUpdates.invalidate();
+}
+
+void ZyppBackend::precomputeApplicationUpdates()
+{
+    if (m_precomputingApplicationUpdates) {
+        // One is enough.
+        return;
     }
+    m_precomputingApplicationUpdates = true;
 
-    m_progressAvailableSteps = static_cast<uint>(ProgressReporter::OperationStep::Download | ProgressReporter::OperationStep::Process);
-    m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::InstallApplications);
-    Hemera::Operation *op = new ZyppPackageOperation(m_zypp, this, packages, PackageOperation::Install, false, this);
-    HANDLE_OPERATION_DBUS(op)
+    // Nobody is waiting for this one: no request to answer.
+    enqueueOperation(OperationQueue::Priority::Background, OperationQueue::Access::Exclusive, QDBusMessage(),
+                     QStringLiteral("precomputeApplicationUpdates"), [this] {
+        m_precomputingApplicationUpdates = false;
+
+        lookupApplicationUpdates(false, [this] (bool success, const QByteArray &, bool) {
+            if (!success) {
+                qWarning() << "Could not precompute the update list.";
+            }
+
+            setStatus(Status::Idle);
+        });
+    }, [this] {
+        // Never ran: the next one must not think it's still coming.
+        m_precomputingApplicationUpdates = false;
+    });
 }
 
-void ZyppBackend::installLocalPackage(const QString &package)
+void ZyppBackend::installApplications(const QByteArray &applications)
 {
     CHECK_DBUS_CALLER_VOID
-    ENQUEUE_OPERATION
-
-    setStatus(Status::Processing);
 
     setDelayedReply(true);
 
-    // Create temporary dir for the repo
-    QTemporaryDir *dir = new QTemporaryDir(QStringLiteral("/var/tmp/hemera-zypp-worker-XXXXXX"));
-
-    QString filename = package.split(QLatin1Char('/')).last();
-    QString cachedPackage = QString::fromLatin1("%1/%2").arg(dir->path(), filename);
+    enqueueOperation(OperationQueue::Priority::Normal, OperationQueue::Access::Exclusive, request, QStringLiteral("installApplications"), [this, request, applications] {
+        using namespace Hemera::SoftwareManagement;
 
-    // download the rpm into the cache
-    QFile::copy(package, cachedPackage);
+        QStringList packages;
+        ApplicationPackages applicationPackages = Constructors::applicationPackagesFromJson(QJsonDocument::fromJson(applications).array());
+        for (const ApplicationPackage &package : applicationPackages) {
+            packages.append(package.applicationId());
+        }
 
-    zypp::RepoManager *manager = prepareLocalRepositoryTransaction(dir->path(), true);
+        m_progressAvailableSteps = static_cast<uint>(ProgressReporter::OperationStep::Download | ProgressReporter::OperationStep::Process);
+        m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::InstallApplications);
+        Hemera::Operation *op = new ZyppPackageOperation(this, packages, PackageOperation::Install, false, this);
+        HANDLE_OPERATION_DBUS(op)
+    });
+}
 
-    // Set resolver options
-    m_zypp->resolver()->setUpgradeMode(false);
-    // Create our commit policy
-    zypp::ZYppCommitPolicy policy;
-    policy = policy.rpmExcludeDocs(true);
+void ZyppBackend::installLocalPackage(const QString &package)
+{
+    CHECK_DBUS_CALLER_VOID
 
-    m_progressAvailableSteps = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationStep::Process);
-    m_progressOperationType = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationType::InstallApplications);
-    ZyppCommitOperation *op = new ZyppCommitOperation(m_zypp, this, manager, policy, this);
-    connect(op, &Hemera::Operation::finished, [this, request, manager, op, dir] {
-            if (op->isError()) {
-                QDBusConnection::systemBus().send(request.createErrorReply(op->errorName(), op->errorMessage()));
-            } else if (op->items() < 1) {
-                QDBusConnection::systemBus().send(request.createErrorReply(Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()),
-                                                                           QStringLiteral("No packages were processed, likely due to conflicts.")));
-            } else {
-                QDBusConnection::systemBus().send(request.createReply());
-            }
+    setDelayedReply(true);
 
-            // We remove our repo, before being done with this.
-            if (!removeRepositoryInternal(QString::fromStdString(manager->getRepo(TMP_RPM_REPO_ALIAS).alias()))) {
-                qWarning() << "Warning: could not remove temporary repository!";
-            }
+    enqueueOperation(OperationQueue::Priority::Normal, OperationQueue::Access::Exclusive, request, QStringLiteral("installLocalPackage"), [this, request, package] {
+        // Create temporary dir for the repo
+        QTemporaryDir *dir = new QTemporaryDir(QStringLiteral("/var/tmp/hemera-zypp-worker-XXXXXX"));
+
+        QString filename = package.split(QLatin1Char('/')).last();
+        QString cachedPackage = QString::fromLatin1("%1/%2").arg(dir->path(), filename);
+
+        // download the rpm into the cache
+        QFile::copy(package, cachedPackage);
+
+        TransactionRequest transaction;
+        transaction.type = TransactionRequest::Type::LocalPackages;
+        transaction.path = dir->path();
+        transaction.force = true;
+
+        m_progressAvailableSteps = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationStep::Process);
+        m_progressOperationType = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationType::InstallApplications);
+        ZyppCommitOperation *op = new ZyppCommitOperation(this, transaction, this);
+        connect(op, &Hemera::Operation::finished, [this, request, op, dir] {
+                if (op->isError()) {
+                    QDBusConnection::systemBus().send(request.createErrorReply(op->errorName(), op->errorMessage()));
+                } else if (op->items() < 1) {
+                    QDBusConnection::systemBus().send(request.createErrorReply(Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()),
+                                                                               QStringLiteral("No packages were processed, likely due to conflicts.")));
+                } else {
+                    QDBusConnection::systemBus().send(request.createReply());
+                }
 
-            delete dir;
-            delete manager;
+                delete dir;
 
-            setStatus(Status::Idle);
+                setStatus(Status::Idle);
+        });
     });
 }
 
 void ZyppBackend::removeApplications(const QByteArray &applications)
 {
     CHECK_DBUS_CALLER_VOID
-    ENQUEUE_OPERATION
+
+    setDelayedReply(true);
+
+    enqueueOperation(OperationQueue::Priority::Normal, OperationQueue::Access::Exclusive, request, QStringLiteral("removeApplications"), [this, request, applications] {
+        using namespace Hemera::SoftwareManagement;
+
+        QStringList packages;
+        ApplicationPackages applicationPackages = Constructors::applicationPackagesFromJson(QJsonDocument::fromJson(applications).array());
+        for (const ApplicationPackage &package : applicationPackages) {
+            packages.append(package.applicationId());
+        }
+
+        m_progressAvailableSteps = static_cast<uint>(ProgressReporter::OperationStep::Process);
+        m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::RemoveApplications);
+        Hemera::Operation *op = new ZyppPackageOperation(this, packages, PackageOperation::Remove, false, this);
+        HANDLE_OPERATION_DBUS(op)
+    });
+}
+
+void ZyppBackend::applyTransaction(const QByteArray &transaction)
+{
+    CHECK_DBUS_CALLER_VOID
 
     using namespace Hemera::SoftwareManagement;
 
-    setStatus(Status::Processing);
+    // [ { "action": "install" | "remove" | "update", "applicationId": "..." }, ... ]
+    PackageIntents intents;
+    bool installs = false;
+    bool updates = false;
+    for (const QJsonValue &value : QJsonDocument::fromJson(transaction).array()) {
+        QJsonObject intent = value.toObject();
+        QString applicationId = intent.value(QStringLiteral("applicationId")).toString();
+        QString action = intent.value(QStringLiteral("action")).toString();
+
+        if (applicationId.isEmpty()) {
+            sendErrorReply(QDBusError::errorString(QDBusError::InvalidArgs), QStringLiteral("Every action needs an applicationId."));
+            return;
+        }
 
-    setDelayedReply(true);
+        if (action == QStringLiteral("install")) {
+            intents.append(qMakePair(applicationId, PackageOperation::Install));
+            installs = true;
+        } else if (action == QStringLiteral("remove")) {
+            intents.append(qMakePair(applicationId, PackageOperation::Remove));
+        } else if (action == QStringLiteral("update")) {
+            intents.append(qMakePair(applicationId, PackageOperation::Update));
+            updates = true;
+        } else {
+            sendErrorReply(QDBusError::errorString(QDBusError::InvalidArgs), QStringLiteral("Unknown action %1 for %2.").arg(action, applicationId));
+            return;
+        }
+    }
 
-    QStringList packages;
-    ApplicationPackages applicationPackages = Constructors::applicationPackagesFromJson(QJsonDocument::fromJson(applications).array());
-    for (const ApplicationPackage &package : applicationPackages) {
-        packages.append(package.applicationId());
+    if (intents.isEmpty()) {
+        sendErrorReply(QDBusError::errorString(QDBusError::InvalidArgs), QStringLiteral("The transaction is empty."));
+        return;
     }
 
-    m_progressAvailableSteps = static_cast<uint>(ProgressReporter::OperationStep::Process);
-    m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::RemoveApplications);
-    Hemera::Operation *op = new ZyppPackageOperation(m_zypp, this, packages, PackageOperation::Remove, false, this);
-    HANDLE_OPERATION_DBUS(op)
+    setDelayedReply(true);
+
+    enqueueOperation(OperationQueue::Priority::Normal, OperationQueue::Access::Exclusive, request, QStringLiteral("applyTransaction"),
+                     [this, request, intents, installs, updates] {
+        // One progress stream for the whole lot. Pure removals have nothing to download.
+        if (updates) {
+            m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::UpdateApplications);
+        } else if (installs) {
+            m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::InstallApplications);
+        } else {
+            m_progressOperationType = static_cast<uint>(ProgressReporter::OperationType::RemoveApplications);
+        }
+        if (installs || updates) {
+            m_progressAvailableSteps = static_cast<uint>(ProgressReporter::OperationStep::Download | ProgressReporter::OperationStep::Process);
+        } else {
+            m_progressAvailableSteps = static_cast<uint>(ProgressReporter::OperationStep::Process);
+        }
+
+        Hemera::Operation *op = new ZyppPackageOperation(this, intents, false, this);
+        HANDLE_OPERATION_DBUS(op)
+    });
 }
 
 QByteArray ZyppBackend::listInstalledApplications()
 {
     CHECK_DBUS_CALLER(QByteArray)
-    ENQUEUE_OPERATION
-
-    setStatus(Status::Processing);
 
-    // Always delay our reply, we don't want to block.
     setDelayedReply(true);
 
-    zypp::RepoManager manager;
+    if (joinPendingRead(QStringLiteral("listInstalledApplications"), request)) {
+        // The same question is on its way already, our caller will get the same answer.
+        return QByteArray();
+    }
 
-    zypp_prepare_pool(m_zypp, &manager);
+    enqueueOperation(OperationQueue::Priority::Interactive, OperationQueue::Access::SnapshotRead, request, QStringLiteral("listInstalledApplications"), [this] {
+        ApplicationIndex::Snapshot applications = m_applications->snapshot();
+        QSharedPointer< QByteArray > installedApplications(new QByteArray);
+        runOnExecutor([this, applications, installedApplications] {
+            // Only the installed set matters here: repositories and marks are left alone, same as for the snapshot.
+            m_pool->loadTarget();
 
-    // Set resolver options
-    m_zypp->resolver()->setUpgradeMode(false);
+            *installedApplications = installedApplicationsJson(applications);
+        }, [this, installedApplications] {
+            // Send reply
+            replyToPendingRead(QStringLiteral("listInstalledApplications"), QVariantList() << *installedApplications);
 
-    QStringList installedHa;
-    QDir hemeraServices(StaticConfig::hemeraServicesPath());
-    hemeraServices.setFilter(QDir::Files | QDir::NoSymLinks);
+            // Done.
+            setStatus(Status::Idle);
+        });
+    });
 
-    Hemera::SoftwareManagement::ApplicationPackages packages;
-    for (const QFileInfo &file : hemeraServices.entryInfoList(QStringList() << QStringLiteral("*.ha"))) {
-        // Query for each package
-        QString applicationId = file.completeBaseName();
-        QString applicationIdTruncated = applicationId;
-        applicationIdTruncated.remove(QLatin1Char('.'));
-        std::string packageName = QString::fromLatin1("ha-%1").arg(applicationIdTruncated).toStdString();
-
-        zypp::PoolQuery q;
-        q.addKind(zypp::ResKind::package);
-        q.setMatchGlob();
-        // Only system packages
-        q.setInstalledOnly();
-
-        // Look for package names
-        q.addDependency(zypp::sat::SolvAttr::name, packageName);
-
-        zypp::PoolItemBest bestMatches(q.begin(), q.end());
-        if (!bestMatches.empty()) {
-            for (zypp::PoolItemBest::iterator sit = bestMatches.begin(); sit != bestMatches.end(); ++sit) {
-                zypp::ui::Selectable::Ptr s(zypp::ui::asSelectable()(*sit));
-
-                zypp::PoolItem instobj = zypp_get_installed_obj(s);
-                if (instobj) {
-                    zypp::ResObject::constPtr resolvable = instobj.resolvable();
-
-                    using namespace Hemera::SoftwareManagement;
-
-                    ApplicationPackage package = Constructors::applicationPackageFromData(applicationId, QString::fromStdString(resolvable->summary()),
-                                                       QString::fromStdString(resolvable->description()), QUrl(), QString::fromStdString(resolvable->name()),
-                                                       QString::fromStdString(resolvable->edition().asString()),
-                                                       resolvable->downloadSize().blocks(zypp::ByteCount::B),
-                                                       resolvable->installSize().blocks(zypp::ByteCount::B), true);
-                    packages.append(package);
-                } else {
-                    qDebug() << "Failed to get installable object! Package was" << packageName.c_str();
-                }
-            }
-        } else {
-            qWarning() << "Package" << packageName.c_str() << "not found, even though a matching hemera service" << applicationId << "is installed!";
-        }
+    return QByteArray();
+}
+
+QByteArray ZyppBackend::listRepositories()
+{
+    CHECK_DBUS_CALLER(QByteArray)
+
+    setDelayedReply(true);
+
+    if (joinPendingRead(QStringLiteral("listRepositories"), request)) {
+        // The same question is on its way already, our caller will get the same answer.
+        return QByteArray();
     }
 
-    // Send reply
-    QDBusMessage reply = request.createReply(QVariantList() << QJsonDocument(Hemera::SoftwareManagement::Constructors::toJson(packages)).toJson(QJsonDocument::Compact));
-    QDBusConnection::systemBus().send(reply);
+    enqueueOperation(OperationQueue::Priority::Interactive, OperationQueue::Access::SnapshotRead, request, QStringLiteral("listRepositories"), [this] {
+        QSharedPointer< QByteArray > repositories(new QByteArray);
+        runOnExecutor([this, repositories] {
+            *repositories = repositoriesJson();
+        }, [this, repositories] {
+            replyToPendingRead(QStringLiteral("listRepositories"), QVariantList() << *repositories);
 
-    // Done.
-    setStatus(Status::Idle);
+            setStatus(Status::Idle);
+        });
+    });
 
-    // Who cares
     return QByteArray();
 }
 
-QByteArray ZyppBackend::listRepositories()
+QByteArray ZyppBackend::installedApplicationsJson(const ApplicationIndex::Snapshot &applications)
 {
-    CHECK_DBUS_CALLER(QByteArray)
-    ENQUEUE_OPERATION
+    // One pass over the installed set, rather than one query per application: hemera application packages, by name.
+    QHash< QString, zypp::sat::Solvable > installedApplications;
+    zypp::Repository systemRepo = zypp::sat::Pool::instance().findSystemRepo();
+    if (systemRepo != zypp::Repository::noRepository) {
+        for (zypp::Repository::SolvableIterator it = systemRepo.solvablesBegin(); it != systemRepo.solvablesEnd(); ++it) {
+            zypp::sat::Solvable solvable = *it;
+            if (!solvable.isKind(zypp::ResKind::package) || solvable.name().compare(0, 3, "ha-") != 0) {
+                continue;
+            }
+
+            // Should there be more than one, the newest wins.
+            QString name = QString::fromStdString(solvable.name());
+            QHash< QString, zypp::sat::Solvable >::iterator known = installedApplications.find(name);
+            if (known == installedApplications.end()) {
+                installedApplications.insert(name, solvable);
+            } else if (known.value().edition() < solvable.edition()) {
+                known.value() = solvable;
+            }
+        }
+    }
+
+    Hemera::SoftwareManagement::ApplicationPackages packages;
+    for (const ApplicationIndex::Application &application : applications.applications()) {
+        QHash< QString, zypp::sat::Solvable >::const_iterator installed = installedApplications.constFind(application.packageName);
+        if (installed == installedApplications.constEnd()) {
+            qWarning() << "Package" << application.packageName << "not found, even though a matching hemera service" << application.applicationId << "is installed!";
+            continue;
+        }
 
-    zypp::RepoManager manager;
+        zypp::ResObject::constPtr resolvable = zypp::PoolItem(installed.value()).resolvable();
 
-    std::list<zypp::RepoInfo> repos;
-    repos.insert(repos.end(), manager.repoBegin(), manager.repoEnd());
+        using namespace Hemera::SoftwareManagement;
+
+        ApplicationPackage package = Constructors::applicationPackageFromData(application.applicationId, QString::fromStdString(resolvable->summary()),
+                                           QString::fromStdString(resolvable->description()), QUrl(), QString::fromStdString(resolvable->name()),
+                                           QString::fromStdString(resolvable->edition().asString()),
+                                           resolvable->downloadSize().blocks(zypp::ByteCount::B),
+                                           resolvable->installSize().blocks(zypp::ByteCount::B), true);
+        packages.append(package);
+    }
+
+    return QJsonDocument(Hemera::SoftwareManagement::Constructors::toJson(packages)).toJson(QJsonDocument::Compact);
+}
+
+QByteArray ZyppBackend::repositoriesJson() const
+{
+    std::list<zypp::RepoInfo> repos = m_pool->repositories();
     qDebug() << "Found " << repos.size() << " repos.";
 
     QJsonArray repositories;
@@ -1103,11 +1563,9 @@ QByteArray ZyppBackend::listRepositories()
 
 
 // Operations
-ZyppRefreshRepositoriesOperation::ZyppRefreshRepositoriesOperation(zypp::ZYpp::Ptr zypp, ZyppBackend *backend, CallbacksManager *callbacks, QObject *parent)
+ZyppRefreshRepositoriesOperation::ZyppRefreshRepositoriesOperation(ZyppBackend *backend, QObject *parent)
     : Hemera::Operation(parent)
-    , m_zypp(zypp)
     , m_backend(backend)
-    , m_callbacks(callbacks)
 {
 }
 
@@ -1117,17 +1575,9 @@ ZyppRefreshRepositoriesOperation::~ZyppRefreshRepositoriesOperation()
 
 void ZyppRefreshRepositoriesOperation::startImpl()
 {
-    zypp::RepoManager manager;
-
-    QString errorString = QStringLiteral("Errors: ");
-
-    std::list<zypp::RepoInfo> repos;
-    repos.insert(repos.end(), manager.repoBegin(), manager.repoEnd());
-    qDebug() << "Found " << repos.size() << " repos.";
-
-    // Set up callbacks and progress
+    // Set up progress
     QDateTime transactionStart = QDateTime::currentDateTime();
-    m_backend->m_progressOperationId = Workers::generateTransactionId(transactionStart);
+    m_backend->m_progressOperationId = m_backend->m_runningOperationId;
     m_backend->m_progressCurrentStep = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationStep::NoStep);
     m_backend->m_progressStartDateTime = transactionStart.toMSecsSinceEpoch();
     m_backend->m_progressAvailableSteps = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationStep::Download);
@@ -1135,70 +1585,35 @@ void ZyppRefreshRepositoriesOperation::startImpl()
     // Transaction type has changed
     Q_EMIT m_backend->progressOperationTypeChanged();
 
-    m_callbacks->setOperationType(CallbacksManager::OperationType::Repository);
-    m_callbacks->setTotalItems(repos.size());
-
-    unsigned repocount = 0, errcount = 0;
-    for (std::list<zypp::RepoInfo>::const_iterator it = repos.begin(); it != repos.end(); ++it, ++repocount) {
-        zypp::Url url = it->url();
-        std::string scheme(url.getScheme());
-
-        if (scheme == "cd" || scheme == "dvd") {
-            qDebug() << "Skipping CD/DVD repository: "
-            "alias:[" << it->alias().c_str() << "] "
-            "url:[" << url.asCompleteString().c_str() << "] ";
-            m_callbacks->notifyRepositoryDone();
-            continue;
-        }
-
-        // refresh only enabled repos with enabled autorefresh (bnc #410791)
-        if (!(it->enabled() /*&& it->autorefresh()*/)) {
-            qDebug() << "Skipping disabled/no-autorefresh repository: "
-            "alias:[" << it->alias().c_str() << "] "
-            "url:[" << url.asCompleteString().c_str() << "] ";
-            m_callbacks->notifyRepositoryDone();
-            continue;
-        }
-
-        try {
-            manager.refreshMetadata(*it);
-            manager.buildCache(*it);
-        } catch (const zypp::Exception &excpt_r ) {
-            qWarning() << " Error:" << endl
-            << "Could not refresh repository " << it->name().c_str() << excpt_r.asUserString().c_str() << excpt_r.historyAsString().c_str();
-            errorString.append(QString::fromStdString(excpt_r.asUserString().c_str()));
-            ++errcount;
-        }
-        m_callbacks->notifyRepositoryDone();
-    }
-
-    if (errcount) {
-        if (repocount == errcount) {
-            // the whole operation failed (all of the repos)
-            qDebug() << "The whole operation failed!";
-            setFinishedWithError(QStringLiteral("Repositories could not be refreshed"), errorString);
-            return;
+    // In zygote mode, metadata and caches are shared through the disk: the pool picks up the changes on its next preparation.
+    TransactionRequest transaction;
+    transaction.type = TransactionRequest::Type::Refresh;
+    Hemera::Operation *op = m_backend->runTransaction(transaction, this);
+    connect(op, &Hemera::Operation::finished, this, [this, op] {
+        if (op->isError()) {
+            setFinishedWithError(op->errorName(), op->errorMessage());
+        } else {
+            setFinished();
         }
+    });
+}
 
-        if (repocount > errcount) {
-            // some of the repos failed
-            qDebug() << "Repositories successfully updated, some not";
-            qWarning() << errorString;
-        }
-    } else {
-        qDebug() << "Repositories successfully updated!";
+ZyppPackageOperation::ZyppPackageOperation(ZyppBackend *backend, const QStringList &packages,
+                                           ZyppBackend::PackageOperation operation, bool downloadOnly, QObject *parent)
+    : Operation(parent)
+    , m_backend(backend)
+    , m_downloadOnly(downloadOnly)
+{
+    for (const QString &package : packages) {
+        m_intents.append(qMakePair(package, operation));
     }
-
-    setFinished();
 }
 
-ZyppPackageOperation::ZyppPackageOperation(zypp::ZYpp::Ptr zypp, ZyppBackend *backend, const QStringList &packages,
-                                           ZyppBackend::PackageOperation operation, bool downloadOnly, QObject *parent)
+ZyppPackageOperation::ZyppPackageOperation(ZyppBackend *backend, const ZyppBackend::PackageIntents &intents,
+                                           bool downloadOnly, QObject *parent)
     : Operation(parent)
-    , m_zypp(zypp)
     , m_backend(backend)
-    , m_packages(packages)
-    , m_operation(operation)
+    , m_intents(intents)
     , m_downloadOnly(downloadOnly)
 {
 }
@@ -1211,48 +1626,27 @@ ZyppPackageOperation::~ZyppPackageOperation()
 
 void ZyppPackageOperation::startImpl()
 {
-    zypp::RepoManager *manager = new zypp::RepoManager;
-
-    zypp_prepare_pool(m_zypp, manager);
-
-    // Set resolver options
-    m_zypp->resolver()->setUpgradeMode(false);
-
-    std::list<zypp::RepoInfo> repos;
-    repos.insert(repos.end(), manager->repoBegin(), manager->repoEnd());
-    // Mark each package for planned operation
-    for (const QString &package : m_packages) {
-        ZyppBackend::markPackage(repos, package.toStdString(), m_operation);
-    }
-
-    // Ok, we should have selected all that was needed. Now it's time to prepare and commit the transaction.
-    // Set resolver options
-    m_zypp->resolver()->setUpgradeMode(false);
-
-    // Create our commit policy
-    zypp::ZYppCommitPolicy policy;
-    if (m_downloadOnly) {
-        policy = policy.downloadMode(zypp::DownloadOnly);
-    }
-    policy.rpmExcludeDocs(true);
-
-    connect(new ZyppCommitOperation(m_zypp, m_backend, manager, policy, this), &Hemera::Operation::finished, [this, manager] (Hemera::Operation *op) {
+    // However many there are, they are marked, resolved and committed together, wherever the transaction runs.
+    TransactionRequest transaction;
+    transaction.type = TransactionRequest::Type::Packages;
+    transaction.intents = m_intents;
+    transaction.downloadOnly = m_downloadOnly;
+
+    connect(new ZyppCommitOperation(m_backend, transaction, this), &Hemera::Operation::finished,
+            [this] (Hemera::Operation *op) {
             if (op->isError()) {
                 setFinishedWithError(op->errorName(), op->errorMessage());
             } else {
                 setFinished();
             }
-
-            delete manager;
     });
 }
 
-ZyppCommitOperation::ZyppCommitOperation(zypp::ZYpp::Ptr zypp, ZyppBackend* backend, zypp::RepoManager *manager, zypp::ZYppCommitPolicy commitPolicy, QObject* parent)
+ZyppCommitOperation::ZyppCommitOperation(ZyppBackend* backend, const TransactionRequest &transaction, QObject* parent)
     : Operation(parent)
-    , m_zypp(zypp)
     , m_backend(backend)
-    , m_manager(manager)
-    , m_policy(commitPolicy)
+    , m_transaction(transaction)
+    , m_items(0)
 {
 }
 
@@ -1264,105 +1658,213 @@ void ZyppCommitOperation::startImpl()
 {
     // Transaction starts now. Let's generate it!
     QDateTime transactionStart = QDateTime::currentDateTime();
-    m_backend->m_progressOperationId = Workers::generateTransactionId(transactionStart);
+    m_backend->m_progressOperationId = m_backend->m_runningOperationId;
     m_backend->m_progressCurrentStep = static_cast<uint>(Hemera::SoftwareManagement::ProgressReporter::OperationStep::NoStep);
     m_backend->m_progressStartDateTime = transactionStart.toMSecsSinceEpoch();
     // Transaction type has changed
     Q_EMIT m_backend->progressOperationTypeChanged();
 
-    // Call the solver
-    qDebug() << "Invoking the solver!";
-    if (!m_zypp->resolver()->resolvePool()) {
-        qWarning() << "Could not resolve the pool!";
-        setFinishedWithError(QStringLiteral("Could not resolve the pool!"), QString());
-        return;
-    }
+    ZyppTransactionOperation *op = static_cast<ZyppTransactionOperation*>(m_backend->runTransaction(m_transaction, this));
+    connect(op, &Hemera::Operation::finished, this, [this, op] {
+        m_items = op->result().toInt();
+        // Whatever happened, the installed set is not what the update list was resolved against anymore.
+        m_backend->invalidateApplicationUpdates();
 
-    qDebug() << "Solver found a solution!";
+        if (op->isError()) {
+            setFinishedWithError(op->errorName(), op->errorMessage());
+        } else {
+            setFinished();
+        }
+    });
+}
 
-    // COMMIT
-    // TODO: Confirm licenses
+int ZyppCommitOperation::items() const
+{
+    return m_items;
+}
 
-    try {
-        qDebug() << "committing transaction";
+ZyppTransactionOperation::ZyppTransactionOperation(ZyppBackend *backend, QObject *parent)
+    : Operation(parent)
+    , m_backend(backend)
+{
+}
 
-        // Give information to our callbacks manager. This also gives more information to the transaction types.
-        m_items = m_backend->configureCallbacksManager(m_zypp->resolver()->getTransaction());
+ZyppTransactionOperation::~ZyppTransactionOperation()
+{
+}
 
-        // WARNING: This blocks the fuck out of everything!
-        zypp::ZYppCommitResult result = m_zypp->commit(m_policy);
+QByteArray ZyppTransactionOperation::result() const
+{
+    return m_result;
+}
 
-        if (!result.noError()) {
-            setFinishedWithError(QStringLiteral("Committing transaction failed!"), QString());
-            return;
-        }
+void ZyppTransactionOperation::finishTransaction(bool success)
+{
+    if (success) {
+        setFinished();
+    } else if (m_backend->m_callbacks->isAborted()) {
+        // Whatever zypp made of the abort, it was asked for.
+        setFinishedWithError(QStringLiteral(OPERATION_CANCELLED_ERROR), QStringLiteral("The operation has been cancelled."));
+    } else if (m_errorName.isEmpty()) {
+        setFinishedWithError(Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()), m_errorMessage);
+    } else {
+        setFinishedWithError(m_errorName, m_errorMessage);
+    }
+}
 
-        // TODO: Handle messages
-        //show_update_messages(zypper, result.updateMessages());
-    } catch (const zypp::media::MediaException &e) {
-        ZYPP_CAUGHT(e);
-        setFinishedWithError(QString::fromStdString(e.asUserString()), QString::fromStdString(e.asUserHistory()));
-        return;
-    } catch (zypp::repo::RepoException &e) {
-        ZYPP_CAUGHT(e);
+ZyppExecutorOperation::ZyppExecutorOperation(ZyppBackend *backend, const ZyppBackend::Transaction &transaction, QObject *parent)
+    : ZyppTransactionOperation(backend, parent)
+    , m_transaction(transaction)
+{
+}
 
-        bool refresh_needed = false;
-        try {
-            if (!e.info().baseUrlsEmpty()) {
-                for (zypp::RepoInfo::urls_const_iterator it = e.info().baseUrlsBegin(); it != e.info().baseUrlsEnd(); ++it) {
-                    zypp::RepoManager::RefreshCheckStatus stat = m_manager->checkIfToRefreshMetadata(e.info(), *it, zypp::RepoManager::RefreshForced);
-                    if (stat == zypp::RepoManager::REFRESH_NEEDED) {
-                        refresh_needed = true;
-                        break;
-                    }
-                }
+ZyppExecutorOperation::~ZyppExecutorOperation()
+{
+}
+
+void ZyppExecutorOperation::startImpl()
+{
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher] {
+        finishTransaction(watcher->result());
+    });
+    // Our members are left alone until the watcher tells us it's done.
+    watcher->setFuture(QtConcurrent::run(m_backend->m_executor, [this] () -> bool {
+        return m_transaction(m_errorName, m_errorMessage, m_result);
+    }));
+}
+
+static bool writeToZygote(int channel, const QByteArray &data)
+{
+    const char *buffer = data.constData();
+    qint64 left = data.size();
+    while (left > 0) {
+        // Should the zygote be gone, we want to hear about it here rather than through SIGPIPE.
+        ssize_t written = ::send(channel, buffer, left, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-        } catch (const zypp::Exception &) {
-            qDebug() << "check if to refresh exception caught, ignoring" << endl;
+            return false;
         }
+        buffer += written;
+        left -= written;
+    }
 
-        if (refresh_needed) {
-            setFinishedWithError(QStringLiteral("Repositories need to be refreshed first."), QString::fromStdString(e.asUserHistory()));
-        } else {
-            setFinishedWithError(QString::fromStdString(e.asUserString()), QString::fromStdString(e.asUserHistory()));
-        }
+    return true;
+}
 
+ZyppZygoteOperation::ZyppZygoteOperation(ZyppBackend *backend, const TransactionRequest &transaction, QObject *parent)
+    : ZyppTransactionOperation(backend, parent)
+    , m_transaction(transaction)
+    , m_notifier(nullptr)
+    , m_done(false)
+{
+}
+
+ZyppZygoteOperation::~ZyppZygoteOperation()
+{
+}
+
+void ZyppZygoteOperation::startImpl()
+{
+    // The queue runs one transaction at a time: the channel is ours until the zygote says exit.
+    if (!writeToZygote(ZyppZygote::channel(), m_transaction.toJson() + '\n')) {
+        finishWithZygoteLost();
         return;
-    } catch (const zypp::FileCheckException &e) {
-        ZYPP_CAUGHT(e);
-        setFinishedWithError(QString::fromStdString(e.asUserString()), QString::fromStdString(e.asUserHistory()));
-//                 zypper.out().error(e,
-//                     _("The package integrity check failed. This may be a problem"
-//                     " with the repository or media. Try one of the following:\n"
-//                     "\n"
-//                     "- just retry previous command\n"
-//                     "- refresh the repositories using 'zypper refresh'\n"
-//                     "- use another installation medium (if e.g. damaged)\n"
-//                     "- use another repository"));
-//                 zypper.setExitCode(ZYPPER_EXIT_ERR_ZYPP);
-        return;
-    } catch (const zypp::Exception &e) {
-        ZYPP_CAUGHT(e);
-        setFinishedWithError(QString::fromStdString(e.asUserString()), QString::fromStdString(e.asUserHistory()));
     }
+    m_backend->m_transactionInZygote = ZyppZygote::runsInZygote(m_transaction);
 
-    // TODO: Handle reboot? We should only if we are updating system, regardless.
-    // TODO: Handle restart? Probably yes.
-    // TODO: Zypper is clever enough to restart affected processes. Maybe we should.
+    m_notifier = new QSocketNotifier(ZyppZygote::channel(), QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &ZyppZygoteOperation::readChannel);
+}
 
-    m_backend->resetCallbacksManager();
+void ZyppZygoteOperation::readChannel()
+{
+    char buffer[4096];
+    ssize_t size = ::read(ZyppZygote::channel(), buffer, sizeof(buffer));
+    if (size < 0 && errno == EINTR) {
+        return;
+    }
 
-    // After a commit, we indeed want to quit right after to clean up zypp.
-    // FIXME: This is probably due to a slight misuse of zypp. Not critical, but would be nice to investigate in the future.
-    // To reproduce: install a package, try to install the same package right after.
-    // Would be nice to fix as it invalidates the operation queue.
-    m_backend->m_timebomb->setInterval(100);
+    if (size <= 0) {
+        m_notifier->setEnabled(false);
+        finishWithZygoteLost();
+        return;
+    }
 
-    setFinished();
+    m_buffer.append(buffer, size);
+
+    int newline;
+    while ((newline = m_buffer.indexOf('\n')) >= 0) {
+        QByteArray line = m_buffer.left(newline);
+        m_buffer.remove(0, newline + 1);
+        if (!handleLine(line)) {
+            // Over: nothing else is ours.
+            return;
+        }
+    }
 }
 
-int ZyppCommitOperation::items() const
+bool ZyppZygoteOperation::handleLine(const QByteArray &line)
 {
-    return m_items;
+    if (line.startsWith("pid ")) {
+        m_backend->m_transactionPid = line.mid(4).toInt();
+        qDebug() << "Transaction running in process" << m_backend->m_transactionPid;
+        if (m_backend->m_callbacks->isAborted()) {
+            // Cancelled before we knew whom to tell.
+            ::kill(m_backend->m_transactionPid, SIGUSR1);
+        }
+    } else if (line == "commit") {
+        // The transaction is about to start rpm: it goes ahead unless a cancellation got here first.
+        QByteArray answer = m_backend->m_callbacks->enterPointOfNoReturn() ? "go\n" : "abort\n";
+        if (!writeToZygote(ZyppZygote::channel(), answer)) {
+            qWarning() << "Could not answer the transaction process, it will give up.";
+        }
+    } else if (line.startsWith("done ")) {
+        m_done = true;
+        m_result = QByteArray::fromPercentEncoding(line.mid(5));
+    } else if (line.startsWith("error ")) {
+        m_done = true;
+        QList<QByteArray> parts = line.mid(6).split(' ');
+        m_errorName = QString::fromUtf8(QByteArray::fromPercentEncoding(parts.value(0)));
+        m_errorMessage = QString::fromUtf8(QByteArray::fromPercentEncoding(parts.value(1)));
+        if (m_errorName.isEmpty()) {
+            m_errorName = Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest());
+        }
+    } else if (line.startsWith("exit ")) {
+        // The zygote is done with it, and waiting for the next one.
+        m_notifier->setEnabled(false);
+        m_backend->m_transactionPid = -1;
+        m_backend->m_transactionInZygote = false;
+
+        if (!m_done) {
+            qWarning() << "Transaction process died without reporting back, status" << line.mid(5).toInt();
+            setFinishedWithError(Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()),
+                                 QStringLiteral("The transaction process terminated unexpectedly."));
+        } else {
+            finishTransaction(m_errorName.isEmpty());
+        }
+        return false;
+    } else if (!m_backend->m_callbacks->handleReport(line)) {
+        qWarning() << "Unknown report from the zygote:" << line;
+    }
+
+    return true;
 }
 
+void ZyppZygoteOperation::finishWithZygoteLost()
+{
+    // It can't be forked again from here, we have threads by now. Stay in business without it.
+    qWarning() << "The zygote is gone, running transactions on the executor from now on.";
+    // For the whole process: a reload must not find the channel, let alone another file reusing its descriptor.
+    if (m_notifier) {
+        m_notifier->setEnabled(false);
+    }
+    ZyppZygote::lost();
+    m_backend->m_transactionPid = -1;
+    m_backend->m_transactionInZygote = false;
+
+    setFinishedWithError(Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()),
+                         QStringLiteral("The zygote terminated unexpectedly."));
+}
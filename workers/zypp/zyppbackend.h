@@ -5,12 +5,30 @@
 
 #include <HemeraCore/Operation>
 
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QVariantMap>
+
 #include <QtDBus/QDBusMessage>
 
+#include "zyppapplicationindex.h"
+#include "zyppapplicationupdatescache.h"
+#include "zyppoperationqueue.h"
+#include "zypppendingreads.h"
+#include "zypptransactionrunner.h"
+
 #include <zypp/ZYpp.h>
 #include <zypp/RepoManager.h>
 
+#include <functional>
+
+#include <sys/types.h>
+
 class CallbacksManager;
+class PoolManager;
+class QSocketNotifier;
+class QThreadPool;
 class QTimer;
 class ZyppBackend : public Hemera::AsyncInitDBusObject
 {
@@ -30,26 +48,39 @@ class ZyppBackend : public Hemera::AsyncInitDBusObject
     Q_PROPERTY(int percent READ progressPercent NOTIFY progressChanged)
     Q_PROPERTY(int rate READ progressRate NOTIFY progressChanged)
 
+    Q_PROPERTY(uint idleTimeout READ idleTimeout NOTIFY idleTimeoutChanged)
+    Q_PROPERTY(bool memoryPressure READ memoryPressure NOTIFY idleTimeoutChanged)
+
+    Q_PROPERTY(QVariantMap startupTimings READ startupTimings NOTIFY startupTimingsChanged)
+    Q_PROPERTY(QVariantMap poolStatistics READ poolStatistics)
+    Q_PROPERTY(QVariantMap queueStatistics READ queueStatistics)
+
+    Q_PROPERTY(uint queueDepth READ queueDepth NOTIFY queueChanged)
+    Q_PROPERTY(QString runningOperationType READ runningOperationType NOTIFY queueChanged)
+    Q_PROPERTY(QByteArray runningOperationId READ runningOperationId NOTIFY queueChanged)
+    Q_PROPERTY(QVariantList queuedOperations READ queuedOperations NOTIFY queueChanged)
+    Q_PROPERTY(QVariantMap operationDurations READ operationDurations NOTIFY queueChanged)
+
 public:
     enum class Status : uint {
         Unknown = 0,
         Uninitialized,
         Idle,
         Processing,
+        Loading,
         Failed = 254
     };
 
     explicit ZyppBackend(QObject *parent = 0);
     virtual ~ZyppBackend();
 
-    enum class PackageOperation : uint {
-        Install,
-        Remove,
-        Update,
-        InstallOrUpdate
-    };
+    typedef TransactionRequest::PackageOperation PackageOperation;
+    typedef TransactionRequest::PackageIntents PackageIntents;
+
+    // A blocking chunk of libzypp work. It never runs on the main thread, see runTransaction.
+    typedef std::function<bool (QString &errorName, QString &errorMessage, QByteArray &result)> Transaction;
 
-    static bool markPackage(const std::list<zypp::RepoInfo> &repos, const std::string &packageName, PackageOperation operation, bool force = false);
+    void recordStartupPhase(const QString &phase, qint64 msecs);
 
 public Q_SLOTS:
     void addRepository(const QString &name, const QStringList &urls);
@@ -59,15 +90,25 @@ public Q_SLOTS:
     void downloadApplicationUpdates(const QByteArray &updates);
     void updateApplications(const QByteArray &updates);
     void updateSystem(const QString &updatePath);
+    QByteArray prepareSystemUpdate(const QString &updatePath);
+    void commitPreparedUpdate(const QByteArray &handle);
 
     void installApplications(const QByteArray &applications);
     void removeApplications(const QByteArray &applications);
     void installLocalPackage(const QString &package);
+    void applyTransaction(const QByteArray &transaction);
 
     QByteArray listUpdates();
+    // Answers from the pool as it is when the solver would take a while. mode tells which one it was,
+    // a provisional list is followed by applicationUpdatesChanged once verified.
+    QByteArray listProvisionalUpdates(QString &mode);
+    QByteArray refreshRepositoriesAndListUpdates();
     QByteArray listInstalledApplications();
     QByteArray listRepositories();
 
+    void cancelOperation(const QByteArray &operationId);
+
+    void setMemoryPressure(bool memoryPressure);
     void setSubscribedToProgress(bool subscribed);
 
     QByteArray progressOperationId() const;
@@ -79,8 +120,18 @@ public Q_SLOTS:
     int progressPercent() const;
     int progressRate() const;
 
-    int configureCallbacksManager(zypp::sat::Transaction transaction);
-    void resetCallbacksManager();
+    uint idleTimeout() const;
+    bool memoryPressure() const;
+
+    QVariantMap startupTimings() const;
+    QVariantMap poolStatistics() const;
+    QVariantMap queueStatistics() const;
+
+    uint queueDepth() const;
+    QString runningOperationType() const;
+    QByteArray runningOperationId() const;
+    QVariantList queuedOperations() const;
+    QVariantMap operationDurations() const;
 
 protected:
     virtual void initImpl() override final;
@@ -88,26 +139,103 @@ protected:
 Q_SIGNALS:
     void statusChanged(uint status);
     void explode();
+    void idleTimeoutChanged();
+    void startupTimingsChanged();
+    void applicationUpdatesChanged(const QByteArray &applicationUpdates);
+    void queueChanged();
 
     void progressOperationTypeChanged();
     void progressCurrentStepChanged();
     void progressDescriptionChanged();
     void progressChanged();
 
+private Q_SLOTS:
+    void dispatchOperation();
+
+    void setProgress(int percent, int rate);
+    void setProgressCurrentStep(uint step);
+
 private:
     void refreshTarget();
 
     void setStatus(Status status);
 
-    bool addRepositoryInternal(const QString &alias, const QStringList &urls, const QDBusMessage &message = QDBusMessage());
-    bool removeRepositoryInternal(const QString &alias, const QDBusMessage &message = QDBusMessage());
-
-    zypp::RepoManager *prepareLocalRepositoryTransaction(const QString &dirPath, bool force = false);
+    Hemera::Operation *runTransaction(const TransactionRequest &transaction, QObject *parent);
+
+    // cancelled runs should the operation be cancelled before it starts, after the caller got its error.
+    void enqueueOperation(OperationQueue::Priority priority, OperationQueue::Access access, const QDBusMessage &request,
+                          const QString &name, const OperationQueue::Task &task,
+                          const OperationQueue::Task &cancelled = OperationQueue::Task());
+    // All of libzypp is driven from the executor: work runs there, done back here once it's over.
+    void runOnExecutor(const std::function<void ()> &work, const std::function<void ()> &done);
+    // Takes the snapshot, then goes on with then.
+    void takeReadSnapshot(const std::function<void ()> &then);
+
+    bool joinPendingRead(const QString &key, const QDBusMessage &request);
+    void replyToPendingRead(const QString &key, const QVariantList &arguments);
+    void replyErrorToPendingRead(const QString &key, const QString &errorName, const QString &errorMessage);
+    // Cancels the calls from service only. False if it had none.
+    bool detachPendingRead(const QString &key, const QString &service);
+
+    void noteIncomingRequest();
+    void armTimebomb();
+
+    // Replies to request once the repository configuration is back in sync with what transaction did.
+    void runRepositoryTransaction(const TransactionRequest &transaction, const QDBusMessage &request);
+
+    // verified tells a list the solver stands for from a provisional one
+    typedef std::function<void (bool success, const QByteArray &applicationUpdatesJson, bool verified)> ApplicationUpdatesLookup;
+
+    // Executor only
+    bool resolveApplicationUpdates(const ApplicationIndex::Snapshot &applications, QByteArray &applicationUpdatesJson);
+    QByteArray provisionalApplicationUpdates(const ApplicationIndex::Snapshot &applications);
+    QByteArray applicationUpdatesKey(const ApplicationIndex::Snapshot &applications) const;
+    // Main thread: the cached list if it still holds, or whatever the solver (or the pool, if provisional) says.
+    void lookupApplicationUpdates(bool provisional, const ApplicationUpdatesLookup &done);
+    bool cachedApplicationUpdates(QByteArray &applicationUpdatesJson);
+    void invalidateApplicationUpdates();
+    void precomputeApplicationUpdates();
+    // Executor only
+    QByteArray installedApplicationsJson(const ApplicationIndex::Snapshot &applications);
+    QByteArray repositoriesJson() const;
+
+    void commitSystemUpdate(const QDBusMessage &request, const QString &updatePath, bool prepared);
+    void discardPreparedUpdate();
 
     zypp::ZYpp::Ptr m_zypp;
     uint m_status;
     QTimer *m_timebomb;
+    QElapsedTimer m_lastRequest;
+    qint64 m_meanRequestInterval;
+    bool m_memoryPressure;
     CallbacksManager *m_callbacks;
+    PoolManager *m_pool;
+    TransactionRunner *m_runner;
+    ApplicationIndex *m_applications;
+    OperationQueue *m_queue;
+    // Our one and only thread for blocking libzypp work
+    QThreadPool *m_executor;
+    OperationQueue::Access m_runningAccess;
+    QByteArray m_runningOperationId;
+    QString m_runningOperationName;
+    QElapsedTimer m_runningOperationTimer;
+    // Zygote mode: the process running the current transaction, if any, or whether the zygote runs it itself.
+    // The zygote reads nothing from us until it's done with those, cancellations included.
+    pid_t m_transactionPid;
+    bool m_transactionInZygote;
+    // read-only call -> its answer, as of when the running download-only writer started
+    QHash< QString, QByteArray > m_readSnapshot;
+    PendingReads m_pendingReads;
+    // phase -> msecs it took
+    QVariantMap m_startupTimings;
+    // System update prepared ahead of its commit: handle and update path. Whether the pool still holds it
+    // is up to whoever prepared it to tell, see TransactionRunner::hasPrepared.
+    QByteArray m_preparedUpdateHandle;
+    QString m_preparedUpdatePath;
+    ApplicationUpdatesCache m_applicationUpdates;
+    quint64 m_applicationUpdatesHits;
+    quint64 m_applicationUpdatesMisses;
+    bool m_precomputingApplicationUpdates;
 
     QByteArray m_progressOperationId;
     qint64 m_progressStartDateTime;
@@ -120,7 +248,11 @@ private:
 
     friend class CallbacksManager;
     friend class ZyppCommitOperation;
+    friend class ZyppExecutorOperation;
+    friend class ZyppPackageOperation;
     friend class ZyppRefreshRepositoriesOperation;
+    friend class ZyppTransactionOperation;
+    friend class ZyppZygoteOperation;
 };
 
 // Operations
@@ -130,16 +262,14 @@ class ZyppRefreshRepositoriesOperation : public Hemera::Operation
     Q_DISABLE_COPY(ZyppRefreshRepositoriesOperation)
 
 public:
-    explicit ZyppRefreshRepositoriesOperation(zypp::ZYpp::Ptr zypp, ZyppBackend *backend, CallbacksManager *callbacks, QObject *parent = nullptr);
+    explicit ZyppRefreshRepositoriesOperation(ZyppBackend *backend, QObject *parent = nullptr);
     virtual ~ZyppRefreshRepositoriesOperation();
 
 protected:
     virtual void startImpl() override final;
 
 private:
-    zypp::ZYpp::Ptr m_zypp;
     ZyppBackend *m_backend;
-    CallbacksManager *m_callbacks;
 };
 
 class ZyppPackageOperation : public Hemera::Operation
@@ -148,18 +278,18 @@ class ZyppPackageOperation : public Hemera::Operation
     Q_DISABLE_COPY(ZyppPackageOperation)
 
 public:
-    explicit ZyppPackageOperation(zypp::ZYpp::Ptr zypp, ZyppBackend *backend, const QStringList &packages,
+    explicit ZyppPackageOperation(ZyppBackend *backend, const QStringList &packages,
                                   ZyppBackend::PackageOperation operation, bool downloadOnly, QObject *parent = nullptr);
+    explicit ZyppPackageOperation(ZyppBackend *backend, const ZyppBackend::PackageIntents &intents,
+                                  bool downloadOnly, QObject *parent = nullptr);
     virtual ~ZyppPackageOperation();
 
 protected:
     virtual void startImpl() override final;
 
 private:
-    zypp::ZYpp::Ptr m_zypp;
     ZyppBackend *m_backend;
-    QStringList m_packages;
-    ZyppBackend::PackageOperation m_operation;
+    ZyppBackend::PackageIntents m_intents;
     bool m_downloadOnly;
 };
 
@@ -169,7 +299,7 @@ class ZyppCommitOperation : public Hemera::Operation
     Q_DISABLE_COPY(ZyppCommitOperation)
 
 public:
-    explicit ZyppCommitOperation(zypp::ZYpp::Ptr zypp, ZyppBackend *backend, zypp::RepoManager *manager, zypp::ZYppCommitPolicy commitPolicy, QObject* parent = nullptr);
+    explicit ZyppCommitOperation(ZyppBackend *backend, const TransactionRequest &transaction, QObject* parent = nullptr);
     virtual ~ZyppCommitOperation();
 
     int items() const;
@@ -178,12 +308,77 @@ protected:
     virtual void startImpl() override final;
 
 private:
-    zypp::ZYpp::Ptr m_zypp;
     ZyppBackend *m_backend;
-    zypp::RepoManager *m_manager;
-    zypp::ZYppCommitPolicy m_policy;
+    TransactionRequest m_transaction;
 
     int m_items;
 };
 
+// Runs a transaction away from the event loop, and reports its outcome back to it.
+class ZyppTransactionOperation : public Hemera::Operation
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ZyppTransactionOperation)
+
+public:
+    virtual ~ZyppTransactionOperation();
+
+    QByteArray result() const;
+
+protected:
+    explicit ZyppTransactionOperation(ZyppBackend *backend, QObject *parent = nullptr);
+
+    void finishTransaction(bool success);
+
+    ZyppBackend *m_backend;
+
+    QString m_errorName;
+    QString m_errorMessage;
+    QByteArray m_result;
+};
+
+// Runs a transaction on the backend's executor thread.
+class ZyppExecutorOperation : public ZyppTransactionOperation
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ZyppExecutorOperation)
+
+public:
+    explicit ZyppExecutorOperation(ZyppBackend *backend, const ZyppBackend::Transaction &transaction, QObject *parent = nullptr);
+    virtual ~ZyppExecutorOperation();
+
+protected:
+    virtual void startImpl() override final;
+
+private:
+    ZyppBackend::Transaction m_transaction;
+};
+
+// Zygote mode: hands a transaction over to the zygote, relaying its progress and outcome.
+// Whatever the transaction process does to its copy of the pool dies with it.
+class ZyppZygoteOperation : public ZyppTransactionOperation
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ZyppZygoteOperation)
+
+public:
+    explicit ZyppZygoteOperation(ZyppBackend *backend, const TransactionRequest &transaction, QObject *parent = nullptr);
+    virtual ~ZyppZygoteOperation();
+
+protected:
+    virtual void startImpl() override final;
+
+private:
+    void readChannel();
+    // False once the transaction is over.
+    bool handleLine(const QByteArray &line);
+    void finishWithZygoteLost();
+
+    TransactionRequest m_transaction;
+    QSocketNotifier *m_notifier;
+    QByteArray m_buffer;
+
+    bool m_done;
+};
+
 #endif // ZYPPBACKEND_H
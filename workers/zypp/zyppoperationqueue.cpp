@@ -0,0 +1,249 @@
+#include "zyppoperationqueue.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+
+#define OPERATION_QUEUE_AGING_MSECS (10 * 1000)
+// What we assume for operations we never saw running, and how fast the averages follow what we see.
+#define OPERATION_QUEUE_DEFAULT_DURATION_MSECS (5 * 1000)
+#define OPERATION_QUEUE_DURATION_SMOOTHING 0.3
+
+OperationQueue::OperationQueue()
+    : OperationQueue(OPERATION_QUEUE_AGING_MSECS)
+{
+}
+
+OperationQueue::OperationQueue(qint64 agingMsecs)
+    : m_agingMsecs(agingMsecs)
+{
+    for (WaitStatistics &statistics : m_statistics) {
+        statistics.dispatched = 0;
+        statistics.aged = 0;
+        statistics.totalWait = 0;
+        statistics.maxWait = 0;
+    }
+}
+
+OperationQueue::~OperationQueue()
+{
+}
+
+void OperationQueue::enqueue(Priority priority, Access access, const QByteArray &id, const QString &name, const Task &task, const Task &cancel)
+{
+    Entry entry;
+    entry.priority = priority;
+    entry.access = access;
+    entry.id = id;
+    entry.name = name;
+    entry.task = task;
+    entry.cancel = cancel;
+    entry.queued.start();
+    m_entries.append(entry);
+
+    qDebug() << "Queued" << name << "with priority" << priorityName(priority) << "," << m_entries.size() << "operations waiting.";
+}
+
+OperationQueue::Task OperationQueue::takeNext(Access *access, QByteArray *id, QString *name)
+{
+    int next = nextIndex(false);
+    if (next < 0) {
+        return Task();
+    }
+
+    Entry entry = takeAt(next);
+    if (access) {
+        *access = entry.access;
+    }
+    if (id) {
+        *id = entry.id;
+    }
+    if (name) {
+        *name = entry.name;
+    }
+    return entry.task;
+}
+
+bool OperationQueue::cancel(const QByteArray &id)
+{
+    for (int i = 0; i < m_entries.size(); ++i) {
+        if (m_entries.at(i).id == id) {
+            // It never ran: keep it out of the wait statistics.
+            Entry entry = m_entries.takeAt(i);
+            qDebug() << "Cancelled" << entry.name << "after waiting" << entry.queued.elapsed() << "msecs.";
+            if (entry.cancel) {
+                entry.cancel();
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+QString OperationQueue::name(const QByteArray &id) const
+{
+    for (const Entry &entry : m_entries) {
+        if (entry.id == id) {
+            return entry.name;
+        }
+    }
+
+    return QString();
+}
+
+bool OperationQueue::hasSnapshotReads() const
+{
+    return nextIndex(true) >= 0;
+}
+
+QString OperationQueue::takeNextSnapshotRead()
+{
+    int next = nextIndex(true);
+    if (next < 0) {
+        return QString();
+    }
+
+    // Whoever serves it from the snapshot just needs to know what was asked.
+    return takeAt(next).name;
+}
+
+int OperationQueue::nextIndex(bool snapshotReadsOnly) const
+{
+    // Entries are in arrival order: on ties, the first one wins.
+    int next = -1;
+    qint64 nextPriority = 0;
+    for (int i = 0; i < m_entries.size(); ++i) {
+        const Entry &entry = m_entries.at(i);
+        if (snapshotReadsOnly && entry.access != Access::SnapshotRead) {
+            continue;
+        }
+
+        qint64 effectivePriority = static_cast<qint64>(entry.priority) - entry.queued.elapsed() / m_agingMsecs;
+        if (next < 0 || effectivePriority < nextPriority) {
+            next = i;
+            nextPriority = effectivePriority;
+        }
+    }
+
+    return next;
+}
+
+OperationQueue::Entry OperationQueue::takeAt(int index)
+{
+    Entry entry = m_entries.takeAt(index);
+    qint64 wait = entry.queued.elapsed();
+
+    WaitStatistics &statistics = m_statistics[static_cast<uint>(entry.priority)];
+    ++statistics.dispatched;
+    if (wait >= m_agingMsecs && entry.priority != Priority::Interactive) {
+        ++statistics.aged;
+    }
+    statistics.totalWait += wait;
+    statistics.maxWait = qMax(statistics.maxWait, wait);
+
+    qDebug() << "Dispatching" << entry.name << "after waiting" << wait << "msecs," << m_entries.size() << "operations still waiting.";
+    return entry;
+}
+
+bool OperationQueue::isEmpty() const
+{
+    return m_entries.isEmpty();
+}
+
+int OperationQueue::size() const
+{
+    return m_entries.size();
+}
+
+QVariantMap OperationQueue::statistics() const
+{
+    QVariantMap result;
+    for (uint i = 0; i < 3; ++i) {
+        const WaitStatistics &statistics = m_statistics[i];
+
+        QVariantMap priorityStatistics;
+        priorityStatistics.insert(QStringLiteral("dispatched"), statistics.dispatched);
+        priorityStatistics.insert(QStringLiteral("aged"), statistics.aged);
+        priorityStatistics.insert(QStringLiteral("meanWait"), statistics.dispatched > 0 ? statistics.totalWait / static_cast<qint64>(statistics.dispatched) : 0);
+        priorityStatistics.insert(QStringLiteral("maxWait"), statistics.maxWait);
+
+        result.insert(priorityName(static_cast<Priority>(i)), priorityStatistics);
+    }
+    result.insert(QStringLiteral("waiting"), m_entries.size());
+
+    return result;
+}
+
+void OperationQueue::recordDuration(const QString &name, qint64 msecs)
+{
+    QHash< QString, qint64 >::iterator it = m_meanDurations.find(name);
+    if (it == m_meanDurations.end()) {
+        m_meanDurations.insert(name, msecs);
+    } else {
+        *it = static_cast<qint64>(OPERATION_QUEUE_DURATION_SMOOTHING * msecs + (1 - OPERATION_QUEUE_DURATION_SMOOTHING) * *it);
+    }
+}
+
+QVariantMap OperationQueue::meanDurations() const
+{
+    QVariantMap result;
+    for (QHash< QString, qint64 >::const_iterator it = m_meanDurations.constBegin(); it != m_meanDurations.constEnd(); ++it) {
+        result.insert(it.key(), it.value());
+    }
+    return result;
+}
+
+qint64 OperationQueue::meanDuration(const QString &name) const
+{
+    return m_meanDurations.value(name, OPERATION_QUEUE_DEFAULT_DURATION_MSECS);
+}
+
+QVariantList OperationQueue::entries(const QString &runningName, qint64 runningElapsed) const
+{
+    // Same ordering nextIndex would give right now. Aging may still reshuffle things later on.
+    QList< QPair< qint64, int > > order;
+    for (int i = 0; i < m_entries.size(); ++i) {
+        const Entry &entry = m_entries.at(i);
+        order.append(qMakePair(static_cast<qint64>(entry.priority) - entry.queued.elapsed() / m_agingMsecs, i));
+    }
+    std::stable_sort(order.begin(), order.end());
+
+    // Whatever is running now is done when it usually is, or right away if it's late already.
+    qint64 start = QDateTime::currentMSecsSinceEpoch();
+    if (!runningName.isEmpty()) {
+        start += qMax(static_cast<qint64>(0), meanDuration(runningName) - runningElapsed);
+    }
+
+    QVariantList result;
+    for (const QPair< qint64, int > &position : order) {
+        const Entry &entry = m_entries.at(position.second);
+
+        QVariantMap operation;
+        operation.insert(QStringLiteral("id"), entry.id);
+        operation.insert(QStringLiteral("name"), entry.name);
+        operation.insert(QStringLiteral("priority"), priorityName(entry.priority));
+        operation.insert(QStringLiteral("waiting"), entry.queued.elapsed());
+        operation.insert(QStringLiteral("estimatedStart"), start);
+        result.append(operation);
+
+        start += meanDuration(entry.name);
+    }
+
+    return result;
+}
+
+QString OperationQueue::priorityName(Priority priority)
+{
+    switch (priority) {
+        case Priority::Interactive:
+            return QStringLiteral("interactive");
+        case Priority::Normal:
+            return QStringLiteral("normal");
+        case Priority::Background:
+            return QStringLiteral("background");
+    }
+
+    return QString();
+}
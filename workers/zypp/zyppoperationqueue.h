@@ -0,0 +1,90 @@
+#ifndef ZYPPOPERATIONQUEUE_H
+#define ZYPPOPERATIONQUEUE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QVariantMap>
+
+#include <functional>
+
+// Operations waiting for the backend to become idle. They are served by priority class, oldest first within a class,
+// and every operation gains one class for each aging interval spent waiting: nothing waits forever.
+// Start estimates are based on how long each kind of operation took so far: they are hints, not promises.
+class OperationQueue {
+public:
+    enum class Priority : uint {
+        Interactive = 0,
+        Normal = 1,
+        Background = 2
+    };
+
+    // How an operation gets along with the others. Snapshot reads only need the repository configuration or
+    // the installed set, and can be answered from a snapshot while a download-only writer is running.
+    enum class Access : uint {
+        Exclusive,
+        Download,
+        SnapshotRead
+    };
+
+    typedef std::function<void()> Task;
+
+    OperationQueue();
+    // agingMsecs: how long an operation waits before gaining a class.
+    explicit OperationQueue(qint64 agingMsecs);
+    ~OperationQueue();
+
+    void enqueue(Priority priority, Access access, const QByteArray &id, const QString &name, const Task &task, const Task &cancel);
+    Task takeNext(Access *access = nullptr, QByteArray *id = nullptr, QString *name = nullptr);
+    bool cancel(const QByteArray &id);
+    // Name of a waiting operation, empty if there's no such thing.
+    QString name(const QByteArray &id) const;
+
+    bool hasSnapshotReads() const;
+    QString takeNextSnapshotRead();
+
+    bool isEmpty() const;
+    int size() const;
+
+    QVariantMap statistics() const;
+
+    // How long each kind of operation usually takes, as observed by whoever runs them.
+    void recordDuration(const QString &name, qint64 msecs);
+    QVariantMap meanDurations() const;
+    // Waiting operations in expected dispatch order, with their estimated start.
+    QVariantList entries(const QString &runningName, qint64 runningElapsed) const;
+
+private:
+    struct Entry {
+        Priority priority;
+        Access access;
+        QByteArray id;
+        QString name;
+        Task task;
+        Task cancel;
+        QElapsedTimer queued;
+    };
+
+    struct WaitStatistics {
+        quint64 dispatched;
+        quint64 aged;
+        qint64 totalWait;
+        qint64 maxWait;
+    };
+
+    static QString priorityName(Priority priority);
+    int nextIndex(bool snapshotReadsOnly) const;
+    Entry takeAt(int index);
+
+    qint64 meanDuration(const QString &name) const;
+
+    qint64 m_agingMsecs;
+    QList<Entry> m_entries;
+    WaitStatistics m_statistics[3];
+    // operation name -> running average of its duration, in msecs
+    QHash< QString, qint64 > m_meanDurations;
+};
+
+#endif // ZYPPOPERATIONQUEUE_H
@@ -0,0 +1,64 @@
+#include "zypppendingreads.h"
+
+PendingReads::PendingReads()
+    : m_coalesced(0)
+{
+}
+
+PendingReads::~PendingReads()
+{
+}
+
+bool PendingReads::join(const QString &key, const QDBusMessage &request)
+{
+    QHash< QString, QList< QDBusMessage > >::iterator it = m_reads.find(key);
+    if (it == m_reads.end()) {
+        // We're the first ones: whoever comes before we're done will share our reply.
+        m_reads.insert(key, QList< QDBusMessage >() << request);
+        return false;
+    }
+
+    it.value().append(request);
+    ++m_coalesced;
+    return true;
+}
+
+bool PendingReads::contains(const QString &key) const
+{
+    return m_reads.contains(key);
+}
+
+QList< QDBusMessage > PendingReads::take(const QString &key)
+{
+    return m_reads.take(key);
+}
+
+QList< QDBusMessage > PendingReads::detach(const QString &key, const QString &service)
+{
+    QList< QDBusMessage > detached;
+
+    QHash< QString, QList< QDBusMessage > >::iterator it = m_reads.find(key);
+    if (it == m_reads.end()) {
+        return detached;
+    }
+
+    for (QList< QDBusMessage >::iterator request = it.value().begin(); request != it.value().end();) {
+        if (request->service() != service) {
+            ++request;
+            continue;
+        }
+        detached.append(*request);
+        request = it.value().erase(request);
+    }
+
+    if (it.value().isEmpty()) {
+        m_reads.erase(it);
+    }
+
+    return detached;
+}
+
+quint64 PendingReads::coalesced() const
+{
+    return m_coalesced;
+}
@@ -0,0 +1,34 @@
+#ifndef ZYPPPENDINGREADS_H
+#define ZYPPPENDINGREADS_H
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QString>
+
+#include <QtDBus/QDBusMessage>
+
+// Read-only calls in flight, by what they ask. Whoever asks the same question while it is on its way
+// waits for the same answer, rather than queueing an operation of its own.
+class PendingReads {
+public:
+    PendingReads();
+    ~PendingReads();
+
+    // False if request is the first one to ask key: getting the answer is up to the caller.
+    bool join(const QString &key, const QDBusMessage &request);
+    bool contains(const QString &key) const;
+    // Everyone waiting for key. Whoever takes them replies to them.
+    QList< QDBusMessage > take(const QString &key);
+    // service's calls for key only. The key goes away with its last caller.
+    QList< QDBusMessage > detach(const QString &key, const QString &service);
+
+    // Calls which joined one already in flight
+    quint64 coalesced() const;
+
+private:
+    // key -> everyone waiting for its answer
+    QHash< QString, QList< QDBusMessage > > m_reads;
+    quint64 m_coalesced;
+};
+
+#endif // ZYPPPENDINGREADS_H
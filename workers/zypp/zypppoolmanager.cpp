@@ -0,0 +1,704 @@
+#include "zypppoolmanager.h"
+
+#include <zypp/IdString.h>
+#include <zypp/Locks.h>
+#include <zypp/ResPool.h>
+#include <zypp/ResPoolProxy.h>
+#include <zypp/Repository.h>
+#include <zypp/RepoInfo.h>
+#include <zypp/Target.h>
+#include <zypp/ZConfig.h>
+
+#include <zypp/parser/ParseException.h>
+#include <zypp/target/rpm/RpmDb.h>
+#include <zypp/sat/Pool.h>
+#include <zypp/sat/Queue.h>
+#include <zypp/sat/detail/PoolImpl.h>
+
+#include <solv/pool.h>
+#include <solv/repo.h>
+#include <solv/repo_rpmdb.h>
+#include <solv/repo_write.h>
+#include <solv/repodata.h>
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QFileInfoList>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStringList>
+
+#include <set>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define POOL_SNAPSHOT_DIR "/var/cache/hemera/zypp-worker/"
+#define POOL_SNAPSHOT_FILE "pool.snapshot"
+#define POOL_SNAPSHOT_MAGIC "HZPSNAP"
+#define POOL_SNAPSHOT_VERSION 1
+#define SYSTEM_REPO_ALIAS "@System"
+// Lower is preferred. Remote repositories keep zypp's default of 99.
+#define LOCAL_REPO_PRIORITY 1
+
+// Where the rpmdb lives, as the target found it. Empty until the pool is initialized.
+static QString s_rpmdbPath;
+
+enum ResolverSettings : quint32 {
+    AllowVendorChange = 1 << 0,
+    CleandepsOnRemove = 1 << 1,
+    ForceResolve = 1 << 2,
+    IgnoreAlreadyRecommended = 1 << 3,
+    OnlyRequires = 1 << 4,
+    SolveSrcPackages = 1 << 5,
+    SystemVerification = 1 << 6
+};
+
+// One solv blob in the snapshot. Offsets are relative to the end of the header.
+struct SnapshotSection {
+    QByteArray alias;
+    QByteArray checksum;
+    quint64 offset;
+    quint64 size;
+};
+
+QDataStream &operator<<(QDataStream &stream, const SnapshotSection &section)
+{
+    return stream << section.alias << section.checksum << section.offset << section.size;
+}
+
+QDataStream &operator>>(QDataStream &stream, SnapshotSection &section)
+{
+    return stream >> section.alias >> section.checksum >> section.offset >> section.size;
+}
+
+static QByteArray solvBlob(zypp::Repository repository)
+{
+    char *buffer = nullptr;
+    size_t size = 0;
+    FILE *fp = ::open_memstream(&buffer, &size);
+    if (!fp) {
+        return QByteArray();
+    }
+
+    int error = ::repo_write(repository.get(), fp);
+    ::fclose(fp);
+
+    QByteArray blob;
+    if (error == 0) {
+        blob = QByteArray(buffer, size);
+    }
+    ::free(buffer);
+
+    return blob;
+}
+
+static bool addSolvBlob(zypp::Repository repository, const uchar *data, quint64 size)
+{
+    FILE *fp = ::fmemopen(const_cast<uchar*>(data), size, "r");
+    if (!fp) {
+        return false;
+    }
+
+    int error = zypp::sat::detail::PoolMember::myPool()._addSolv(repository.get(), fp);
+    ::fclose(fp);
+
+    return error == 0;
+}
+
+PoolManager::PoolManager(zypp::ZYpp::Ptr zypp)
+    : m_zypp(zypp)
+    , m_manager(new zypp::RepoManager)
+    , m_snapshotDirty(true)
+    , m_rpmdbCookieHits(0)
+    , m_rpmdbCookieMisses(0)
+    , m_stateSerial(0)
+    , m_selectablesSerial(0)
+    , m_selectablesValid(false)
+{
+}
+
+PoolManager::~PoolManager()
+{
+    delete m_manager;
+}
+
+zypp::RepoManager *PoolManager::repoManager() const
+{
+    return m_manager;
+}
+
+std::list<zypp::RepoInfo> PoolManager::repositories() const
+{
+    std::list<zypp::RepoInfo> repos;
+    repos.insert(repos.end(), m_manager->repoBegin(), m_manager->repoEnd());
+    return repos;
+}
+
+bool PoolManager::hasLoadedRepositories() const
+{
+    return !m_loadedRepos.empty();
+}
+
+void PoolManager::reloadRepositories()
+{
+    // The pool is left alone: preparePool drops whatever is not configured anymore.
+    delete m_manager;
+    m_manager = new zypp::RepoManager;
+}
+
+QByteArray PoolManager::rpmdbCookie()
+{
+    // No rpmdb, no way to tell what changed: callers must take an empty cookie as a miss.
+    if (s_rpmdbPath.isEmpty()) {
+        return QByteArray();
+    }
+
+    // Whichever backend is in use, a transaction changes its data files. Leave out what changes on mere reads:
+    // the Berkeley DB environment and sqlite's shared memory. Lock files are hidden, and skipped as well.
+    QByteArray cookie;
+    QFileInfoList files = QDir(s_rpmdbPath).entryInfoList(QDir::Files, QDir::Name);
+    for (const QFileInfo &info : files) {
+        if (info.fileName().startsWith(QStringLiteral("__db.")) || info.fileName().endsWith(QStringLiteral("-shm"))) {
+            continue;
+        }
+        cookie.append(QString::fromLatin1("%1:%2:%3;").arg(info.fileName()).arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch()).toLatin1());
+    }
+
+    return cookie;
+}
+
+QByteArray PoolManager::stateFingerprint() const
+{
+    // Whatever a resolution depends on: installed set, resolver settings and metadata of every enabled repository.
+    QByteArray fingerprint = rpmdbCookie();
+    if (fingerprint.isEmpty()) {
+        // Without the installed set, there's nothing to compare against.
+        return QByteArray();
+    }
+    fingerprint.append(QByteArray::number(resolverSettingsFlags()));
+    for (zypp::RepoManager::RepoConstIterator it = m_manager->repoBegin(); it != m_manager->repoEnd(); ++it) {
+        if (!it->enabled()) {
+            continue;
+        }
+        fingerprint.append(';');
+        fingerprint.append(it->alias().c_str());
+        fingerprint.append(':');
+        fingerprint.append(m_manager->metadataStatus(*it).checksum().c_str());
+    }
+
+    return fingerprint;
+}
+
+quint64 PoolManager::rpmdbCookieHits() const
+{
+    return m_rpmdbCookieHits;
+}
+
+quint64 PoolManager::rpmdbCookieMisses() const
+{
+    return m_rpmdbCookieMisses;
+}
+
+quint64 PoolManager::stateSerial() const
+{
+    return m_stateSerial;
+}
+
+quint32 PoolManager::resolverSettingsFlags()
+{
+    // Keep in sync with applyResolverSettings: a snapshot built with different settings is useless.
+    return CleandepsOnRemove | ForceResolve | IgnoreAlreadyRecommended | SystemVerification;
+}
+
+bool PoolManager::initialize()
+{
+    locateRpmdb();
+
+    // On a miss the pool is left empty: the caller prepares it, the hard way.
+    return loadSnapshot();
+}
+
+void PoolManager::locateRpmdb()
+{
+    // Wherever rpm is configured to keep it (%_dbpath), as resolved by the target.
+    zypp::Target_Ptr target = m_zypp->getTarget();
+    if (!target) {
+        qWarning() << "No target, the rpmdb can't be tracked.";
+        return;
+    }
+
+    s_rpmdbPath = QString::fromStdString((target->root() / target->rpmDb().dbPath()).asString());
+    qDebug() << "Tracking the rpmdb in" << s_rpmdbPath;
+}
+
+bool PoolManager::loadSnapshot()
+{
+    QFile snapshot(QStringLiteral(POOL_SNAPSHOT_DIR POOL_SNAPSHOT_FILE));
+    if (!snapshot.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    // One mapping for the whole thing. libsolv copies what it needs, so it can go away right after.
+    uchar *data = snapshot.map(0, snapshot.size());
+    if (!data) {
+        qWarning() << "Could not map the pool snapshot, loading the pool from scratch.";
+        return false;
+    }
+
+    QByteArray mapping = QByteArray::fromRawData(reinterpret_cast<const char*>(data), snapshot.size());
+    QDataStream stream(mapping);
+
+    QByteArray magic;
+    quint32 version;
+    quint32 resolverFlags;
+    QByteArray cookie;
+    QList<QByteArray> autoInstalled;
+    QList<SnapshotSection> sections;
+    stream >> magic >> version >> resolverFlags >> cookie >> autoInstalled >> sections;
+
+    if (stream.status() != QDataStream::Ok || magic != POOL_SNAPSHOT_MAGIC || version != POOL_SNAPSHOT_VERSION ||
+        resolverFlags != resolverSettingsFlags()) {
+        qDebug() << "Pool snapshot is not compatible, ignoring it.";
+        snapshot.unmap(data);
+        return false;
+    }
+
+    if (cookie.isEmpty() || cookie != rpmdbCookie()) {
+        qDebug() << "rpmdb changed since the pool snapshot was taken, ignoring it.";
+        snapshot.unmap(data);
+        return false;
+    }
+
+    const uchar *payload = data + stream.device()->pos();
+    quint64 payloadSize = snapshot.size() - stream.device()->pos();
+
+    bool systemLoaded = false;
+    int loadedRepos = 0;
+    for (const SnapshotSection &section : sections) {
+        if (section.offset + section.size > payloadSize) {
+            qWarning() << "Pool snapshot is truncated!";
+            break;
+        }
+
+        std::string alias = section.alias.toStdString();
+        if (alias == SYSTEM_REPO_ALIAS) {
+            zypp::Repository system = zypp::sat::Pool::instance().systemRepo();
+            if (!system.solvablesEmpty()) {
+                system.eraseFromPool();
+                system = zypp::sat::Pool::instance().systemRepo();
+            }
+            systemLoaded = addSolvBlob(system, payload + section.offset, section.size);
+            continue;
+        }
+
+        // Only take repositories whose cache did not change in the meanwhile. The others will be loaded on demand.
+        if (!m_manager->hasRepo(alias)) {
+            continue;
+        }
+        zypp::RepoInfo repo = m_manager->getRepo(alias);
+        if (!repo.enabled() || m_manager->cacheStatus(repo).checksum() != section.checksum.toStdString()) {
+            continue;
+        }
+
+        zypp::Repository repository = zypp::sat::Pool::instance().reposInsert(alias);
+        repository.setInfo(repo);
+        if (addSolvBlob(repository, payload + section.offset, section.size)) {
+            m_loadedRepos[alias] = section.checksum.toStdString();
+            ++loadedRepos;
+        } else {
+            repository.eraseFromPool();
+        }
+    }
+
+    snapshot.unmap(data);
+
+    if (!systemLoaded) {
+        qWarning() << "Pool snapshot has no usable system repository, loading the pool from scratch.";
+        return false;
+    }
+
+    zypp::sat::Queue autoInstalledIds;
+    for (const QByteArray &ident : autoInstalled) {
+        autoInstalledIds.push(zypp::IdString(ident.constData()).id());
+    }
+    zypp::sat::Pool::instance().setAutoInstalled(autoInstalledIds);
+
+    applyTargetSettings();
+
+    m_rpmdbCookie = cookie;
+    m_snapshotDirty = false;
+
+    qDebug() << "Pool restored from snapshot, with" << loadedRepos << "repos.";
+    return true;
+}
+
+void PoolManager::applyTargetSettings()
+{
+    // Target::load does more than reading the rpmdb: since we skipped it, replay the rest of what it sets up.
+    zypp::Target_Ptr target = m_zypp->getTarget();
+    if (!target) {
+        return;
+    }
+
+    // Like Target::load, leave the pool alone if nothing was ever requested.
+    zypp::LocaleSet requestedLocales = target->requestedLocales();
+    if (!requestedLocales.empty()) {
+        zypp::sat::Pool::instance().initRequestedLocales(requestedLocales);
+    }
+
+    if (zypp::ZConfig::instance().apply_locks_file()) {
+        zypp::Locks::instance().readAndApply(zypp::ZConfig::instance().locksFile());
+    }
+}
+
+void PoolManager::writeSnapshot()
+{
+    if (!m_snapshotDirty) {
+        return;
+    }
+
+    zypp::Repository system = zypp::sat::Pool::instance().findSystemRepo();
+    if (system == zypp::Repository::noRepository) {
+        // Nothing worth saving
+        return;
+    }
+
+    // A snapshot we can't validate on the next start is no good.
+    QByteArray cookie = rpmdbCookie();
+    if (cookie.isEmpty()) {
+        return;
+    }
+
+    QList<SnapshotSection> sections;
+    QByteArray payload;
+
+    auto appendSection = [&sections, &payload] (const std::string &alias, const std::string &checksum, zypp::Repository repository) -> bool {
+        QByteArray blob = solvBlob(repository);
+        if (blob.isEmpty()) {
+            return false;
+        }
+
+        SnapshotSection section;
+        section.alias = QByteArray(alias.c_str());
+        section.checksum = QByteArray(checksum.c_str());
+        section.offset = payload.size();
+        section.size = blob.size();
+        sections.append(section);
+        payload.append(blob);
+        return true;
+    };
+
+    if (!appendSection(SYSTEM_REPO_ALIAS, std::string(), system)) {
+        qWarning() << "Could not serialize the system repository, not writing a pool snapshot.";
+        return;
+    }
+
+    for (std::map<std::string, std::string>::const_iterator it = m_loadedRepos.begin(); it != m_loadedRepos.end(); ++it) {
+        zypp::Repository repository = zypp::sat::Pool::instance().reposFind(it->first);
+        // Skip anything transient which never made it to the repository configuration
+        if (repository == zypp::Repository::noRepository || !m_manager->hasRepo(it->first)) {
+            continue;
+        }
+        appendSection(it->first, it->second, repository);
+    }
+
+    QList<QByteArray> autoInstalled;
+    zypp::sat::Queue autoInstalledIds = zypp::sat::Pool::instance().autoInstalled();
+    for (zypp::sat::Queue::const_iterator it = autoInstalledIds.begin(); it != autoInstalledIds.end(); ++it) {
+        autoInstalled.append(QByteArray(zypp::IdString(*it).c_str()));
+    }
+
+    QDir().mkpath(QStringLiteral(POOL_SNAPSHOT_DIR));
+    QSaveFile snapshot(QStringLiteral(POOL_SNAPSHOT_DIR POOL_SNAPSHOT_FILE));
+    if (!snapshot.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write the pool snapshot!" << snapshot.errorString();
+        return;
+    }
+
+    {
+        QDataStream stream(&snapshot);
+        stream << QByteArray(POOL_SNAPSHOT_MAGIC) << static_cast<quint32>(POOL_SNAPSHOT_VERSION) << resolverSettingsFlags()
+               << cookie << autoInstalled << sections;
+    }
+    snapshot.write(payload);
+
+    if (!snapshot.commit()) {
+        qWarning() << "Could not write the pool snapshot!" << snapshot.errorString();
+        return;
+    }
+
+    m_snapshotDirty = false;
+    qDebug() << "Pool snapshot written," << sections.size() << "sections," << payload.size() << "bytes.";
+}
+
+void PoolManager::preparePool()
+{
+    // The pool outlives operations: make sure nothing from a previous one leaks into this one.
+    resetPoolState();
+    dropLocalRepository();
+
+    std::list<zypp::RepoInfo> repos = repositories();
+    qDebug() << "Found " << repos.size() << " repos.";
+
+    std::set<std::string> enabledAliases;
+    int reused = 0;
+
+    for (std::list<zypp::RepoInfo>::const_iterator it = repos.begin(); it != repos.end(); ++it) {
+        const zypp::RepoInfo &repo = *it;
+
+        if (!repo.enabled()) {
+            // Skip disabled repos. If they were loaded before, they'll be dropped below.
+            continue;
+        }
+
+        enabledAliases.insert(repo.alias());
+
+        if (loadRepository(repo) == RepositoryLoad::Reused) {
+            ++reused;
+        }
+    }
+
+    // Drop whatever has been removed or disabled in the meanwhile.
+    std::list<std::string> stale;
+    for (std::map<std::string, std::string>::const_iterator it = m_loadedRepos.begin(); it != m_loadedRepos.end(); ++it) {
+        if (enabledAliases.find(it->first) == enabledAliases.end()) {
+            stale.push_back(it->first);
+        }
+    }
+    for (const std::string &alias : stale) {
+        dropRepository(alias);
+    }
+
+    qDebug() << "Reused" << reused << "repos already in the pool.";
+
+    loadTarget();
+
+    // Ok, resolvables loaded.
+    applyResolverSettings();
+}
+
+bool PoolManager::prepareLocalPool(const std::string &alias, const QString &packagesPath, zypp::RepoInfo &repo)
+{
+    resetPoolState();
+    dropLocalRepository();
+
+    // Remote repositories stay where they are: dropping them would cost the next transaction a full reload.
+    // Only the local packages are marked, and an upgrade is scoped to them (see TransactionRunner::prepare).
+    // The repository lives in the pool only: no configuration, no metadata, no solv cache.
+    repo = zypp::RepoInfo();
+    repo.setAlias(alias);
+    repo.setName(alias);
+    repo.setType(zypp::repo::RepoType::RPMPLAINDIR);
+    repo.addBaseUrl(zypp::Url(QString::fromLatin1("dir://%1").arg(packagesPath).toStdString()));
+    // See TransactionRunner::addRepository.
+    repo.setPackagesPath("/tmp");
+    repo.setEnabled(true);
+    repo.setAutorefresh(false);
+    repo.setKeepPackages(false);
+    // Whatever the solver needs and the local packages provide comes from them, rather than from a remote repository.
+    repo.setPriority(LOCAL_REPO_PRIORITY);
+
+    zypp::Repository repository = zypp::sat::Pool::instance().reposInsert(alias);
+    repository.setInfo(repo);
+
+    ::Repo *satRepo = repository.get();
+    ::Repodata *data = ::repo_add_repodata(satRepo, 0);
+
+    QFileInfoList packages = QDir(packagesPath).entryInfoList(QStringList() << QStringLiteral("*.rpm"));
+    for (const QFileInfo &package : packages) {
+        Id solvable = ::repo_add_rpm(satRepo, QFile::encodeName(package.absoluteFilePath()).constData(),
+                                     REPO_REUSE_REPODATA | REPO_NO_INTERNALIZE | REPO_NO_LOCATION | RPM_ADD_WITH_PKGID | RPM_ADD_WITH_SHA256SUM);
+        if (!solvable) {
+            qWarning() << "Could not read" << package.fileName() << ":" << ::pool_errstr(satRepo->pool);
+            repository.eraseFromPool();
+            return false;
+        }
+
+        // Relative to the repository URL, as zypp expects it when providing the package.
+        ::repodata_set_location(data, solvable, 0, 0, QFile::encodeName(package.fileName()).constData());
+    }
+
+    ::repo_internalize(satRepo);
+    // We went behind zypp's back, let it know.
+    zypp::sat::detail::PoolMember::myPool().setDirty(__FUNCTION__, alias.c_str());
+
+    m_localRepoAlias = alias;
+    qDebug() << "Local repository" << alias.c_str() << "created in the pool with" << packages.size() << "packages.";
+
+    loadTarget();
+
+    applyResolverSettings();
+
+    return true;
+}
+
+void PoolManager::dropLocalRepository()
+{
+    if (m_localRepoAlias.empty()) {
+        return;
+    }
+
+    zypp::Repository repository = zypp::sat::Pool::instance().reposFind(m_localRepoAlias);
+    if (repository != zypp::Repository::noRepository) {
+        repository.eraseFromPool();
+    }
+    m_localRepoAlias.clear();
+    ++m_stateSerial;
+}
+
+PoolManager::RepositoryLoad PoolManager::loadRepository(const zypp::RepoInfo &repo)
+{
+    try {
+        // if there is no metadata locally
+        if (m_manager->metadataStatus(repo).empty()) {
+            // TODO: See refresh_raw_metadata. Here we need to force a raw metadata refresh if
+            //       the metadata is empty.
+        }
+
+        // This rebuilds the solv cache only when the raw metadata changed since the last build.
+        try {
+            m_manager->buildCache(repo, zypp::RepoManager::BuildIfNeeded);
+        } catch (const zypp::parser::ParseException & e) {
+            ZYPP_CAUGHT(e);
+
+            qWarning() << "Error parsing metadata for" << repo.alias().c_str();
+            return RepositoryLoad::Failed;
+        } catch (const zypp::repo::RepoMetadataException & e) {
+            ZYPP_CAUGHT(e);
+
+            // this should not happen and is probably a bug.
+            qWarning() << "Repository metadata for" << repo.alias().c_str() << "not found in local cache. This should not happen.";
+            return RepositoryLoad::Failed;
+        } catch (const zypp::Exception &e) {
+            ZYPP_CAUGHT(e);
+
+            qWarning() << "Error writing to cache db";
+            return RepositoryLoad::Failed;
+        }
+
+        // Is what we have in the pool still good?
+        std::string cacheChecksum = m_manager->cacheStatus(repo).checksum();
+        zypp::Repository loaded = zypp::sat::Pool::instance().reposFind(repo.alias());
+        std::map<std::string, std::string>::const_iterator known = m_loadedRepos.find(repo.alias());
+        if (loaded != zypp::Repository::noRepository && known != m_loadedRepos.end() && known->second == cacheChecksum) {
+            return RepositoryLoad::Reused;
+        }
+
+        if (loaded != zypp::Repository::noRepository) {
+            qDebug() << "Cache for" << repo.alias().c_str() << "changed, reloading it.";
+            loaded.eraseFromPool();
+        }
+
+        m_manager->loadFromCache(repo);
+        m_loadedRepos[repo.alias()] = cacheChecksum;
+        m_snapshotDirty = true;
+        ++m_stateSerial;
+
+        // check that the metadata is not outdated
+        zypp::Repository robj = zypp::sat::Pool::instance().reposFind(repo.alias());
+        if (robj != zypp::Repository::noRepository && robj.maybeOutdated()) {
+            qWarning() << "Repository" << repo.alias().c_str() << "appears to be outdated. Consider using a different mirror or server.";
+        }
+
+        return RepositoryLoad::Loaded;
+    } catch (const zypp::Exception & e) {
+        ZYPP_CAUGHT(e);
+
+        m_loadedRepos.erase(repo.alias());
+        qWarning() << "Resolvables from" << repo.alias().c_str() << "not loaded because of error.";
+        return RepositoryLoad::Failed;
+    }
+}
+
+void PoolManager::dropRepository(const std::string &alias)
+{
+    qDebug() << "Dropping" << alias.c_str() << "from the pool.";
+    zypp::Repository repository = zypp::sat::Pool::instance().reposFind(alias);
+    if (repository != zypp::Repository::noRepository) {
+        repository.eraseFromPool();
+    }
+    m_loadedRepos.erase(alias);
+    m_snapshotDirty = true;
+    ++m_stateSerial;
+}
+
+void PoolManager::resetPoolState()
+{
+    // Drop any transaction left in the pool, be it ours (the user) or the solver's.
+    zypp::ResPool pool = zypp::ResPool::instance();
+    for (zypp::ResPool::const_iterator it = pool.begin(); it != pool.end(); ++it) {
+        it->statusReset();
+    }
+
+    m_zypp->resolver()->undo();
+    m_zypp->resolver()->reset();
+    m_zypp->resolver()->setUpgradeMode(false);
+    m_zypp->resolver()->removeUpgradeRepos();
+
+    ++m_stateSerial;
+}
+
+void PoolManager::loadTarget()
+{
+    // Take the cookie before loading: if the rpmdb changes while we read it, we'll just load it again next time.
+    QByteArray cookie = rpmdbCookie();
+    if (!cookie.isEmpty() && m_rpmdbCookie == cookie &&
+        zypp::sat::Pool::instance().findSystemRepo() != zypp::Repository::noRepository) {
+        // Nothing was installed or removed since the last time, what we have in the pool is still accurate.
+        ++m_rpmdbCookieHits;
+        return;
+    }
+
+    ++m_rpmdbCookieMisses;
+    m_snapshotDirty = true;
+    ++m_stateSerial;
+
+    try {
+        m_zypp->target()->load();
+        m_rpmdbCookie = cookie;
+    } catch ( const zypp::Exception & e ) {
+        ZYPP_CAUGHT(e);
+        qWarning() << "Problem occured while reading the installed packages:" << e.asUserHistory().c_str();
+        m_rpmdbCookie.clear();
+    }
+}
+
+zypp::ui::Selectable::Ptr PoolManager::packageSelectable(const std::string &name)
+{
+    // The serial changes whenever solvables come or go. Marks don't change it, and don't matter here.
+    unsigned serial = zypp::sat::Pool::instance().serial().serial();
+    if (!m_selectablesValid || serial != m_selectablesSerial) {
+        m_selectables.clear();
+
+        const zypp::ResPoolProxy &proxy = m_zypp->poolProxy();
+        for (zypp::ResPoolProxy::const_iterator it = proxy.byKindBegin(zypp::ResKind::package); it != proxy.byKindEnd(zypp::ResKind::package); ++it) {
+            m_selectables[(*it)->name()] = *it;
+        }
+
+        qDebug() << "Indexed" << m_selectables.size() << "package selectables.";
+        m_selectablesSerial = serial;
+        m_selectablesValid = true;
+    }
+
+    std::unordered_map<std::string, zypp::ui::Selectable::Ptr>::const_iterator it = m_selectables.find(name);
+    if (it == m_selectables.end()) {
+        return zypp::ui::Selectable::Ptr();
+    }
+    return it->second;
+}
+
+void PoolManager::applyResolverSettings()
+{
+    // Keep in sync with resolverSettingsFlags
+    m_zypp->resolver()->setAllowVendorChange(false);
+    m_zypp->resolver()->setCleandepsOnRemove(true);
+    m_zypp->resolver()->setForceResolve(true);
+    m_zypp->resolver()->setIgnoreAlreadyRecommended(true);
+    m_zypp->resolver()->setOnlyRequires(false);
+    m_zypp->resolver()->setSolveSrcPackages(false);
+    m_zypp->resolver()->setSystemVerification(true);
+}
@@ -0,0 +1,91 @@
+#ifndef ZYPPPOOLMANAGER_H
+#define ZYPPPOOLMANAGER_H
+
+#include <zypp/ZYpp.h>
+#include <zypp/RepoManager.h>
+#include <zypp/ui/Selectable.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+// Keeps the libsolv pool resident for the whole lifetime of the backend. Repositories are loaded once,
+// and reloaded only when their solv cache changes.
+class PoolManager {
+public:
+    explicit PoolManager(zypp::ZYpp::Ptr zypp);
+    ~PoolManager();
+
+    zypp::RepoManager *repoManager() const;
+    std::list<zypp::RepoInfo> repositories() const;
+    // Whether any configured repository is in the pool, as opposed to the target alone.
+    bool hasLoadedRepositories() const;
+    // Rereads the repository configuration, for when someone else changed it.
+    void reloadRepositories();
+
+    // Restores the pool from the last snapshot, if it still matches the system.
+    bool initialize();
+    void preparePool();
+    bool prepareLocalPool(const std::string &alias, const QString &packagesPath, zypp::RepoInfo &repo);
+    void dropLocalRepository();
+    void resetPoolState();
+    void loadTarget();
+
+    // Bumped whenever the pool is touched: marks reset, repositories or target (re)loaded or dropped.
+    // Whoever leaves something in the pool for later can tell whether it's still there.
+    quint64 stateSerial() const;
+
+    // Package selectable by name, from an index rebuilt whenever the pool contents change.
+    zypp::ui::Selectable::Ptr packageSelectable(const std::string &name);
+
+    void writeSnapshot();
+
+    // Changes whenever the rpmdb does. Empty if the rpmdb can't be found: that's never a match.
+    static QByteArray rpmdbCookie();
+    QByteArray stateFingerprint() const;
+
+    quint64 rpmdbCookieHits() const;
+    quint64 rpmdbCookieMisses() const;
+
+private:
+    enum class RepositoryLoad {
+        Reused,
+        Loaded,
+        Failed
+    };
+
+    void locateRpmdb();
+    bool loadSnapshot();
+    void applyTargetSettings();
+    RepositoryLoad loadRepository(const zypp::RepoInfo &repo);
+    void dropRepository(const std::string &alias);
+    void applyResolverSettings();
+    static quint32 resolverSettingsFlags();
+
+    zypp::ZYpp::Ptr m_zypp;
+    zypp::RepoManager *m_manager;
+
+    // alias -> checksum of the solv cache currently loaded in the pool
+    std::map<std::string, std::string> m_loadedRepos;
+    // rpmdb cookie the system repo in the pool was loaded from, be it from the rpmdb or a snapshot
+    QByteArray m_rpmdbCookie;
+    bool m_snapshotDirty;
+    // in-memory repository of the running local transaction, if any
+    std::string m_localRepoAlias;
+
+    quint64 m_rpmdbCookieHits;
+    quint64 m_rpmdbCookieMisses;
+
+    quint64 m_stateSerial;
+
+    // package name -> selectable, valid for the pool serial it was built at
+    std::unordered_map<std::string, zypp::ui::Selectable::Ptr> m_selectables;
+    unsigned m_selectablesSerial;
+    bool m_selectablesValid;
+};
+
+#endif // ZYPPPOOLMANAGER_H
@@ -0,0 +1,748 @@
+#include "zypptransactionrunner.h"
+
+#include "zyppworkercallbacks.h"
+#include "zypppoolmanager.h"
+
+#include <zypp/FileChecker.h>
+#include <zypp/PoolItem.h>
+#include <zypp/RepoManager.h>
+#include <zypp/ResPool.h>
+#include <zypp/ZYppCommitResult.h>
+
+#include <zypp/media/MediaException.h>
+#include <zypp/sat/Pool.h>
+#include <zypp/target/rpm/RpmHeader.h>
+#include <zypp/ui/Selectable.h>
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+
+#include <QtDBus/QDBusError>
+
+#include <set>
+
+#define TMP_RPM_REPO_ALIAS "hemera-temp-local-repo"
+
+#define DOWNLOAD_FAILED_ERROR "com.ispirata.Hemera.SoftwareManager.Error.DownloadFailed"
+#define COMMIT_FAILED_ERROR "com.ispirata.Hemera.SoftwareManager.Error.CommitFailed"
+#define INTEGRITY_CHECK_FAILED_ERROR "com.ispirata.Hemera.SoftwareManager.Error.IntegrityCheckFailed"
+#define REPOSITORY_ERROR "com.ispirata.Hemera.SoftwareManager.Error.RepositoryError"
+#define REFRESH_NEEDED_ERROR "com.ispirata.Hemera.SoftwareManager.Error.RefreshNeeded"
+#define REFRESH_FAILED_ERROR "com.ispirata.Hemera.SoftwareManager.Error.RefreshFailed"
+
+zypp::PoolItem zypp_get_installed_obj(zypp::ui::Selectable::Ptr & s)
+{
+    zypp::PoolItem installed;
+    if (zypp::traits::isPseudoInstalled(s->kind())) {
+        for_(it, s->availableBegin(), s->availableEnd())
+        // this is OK also for patches - isSatisfied() excludes !isRelevant()
+        if (it->status().isSatisfied()
+            && (!installed || installed->edition() < (*it)->edition())) {
+            installed = *it;
+        }
+    } else {
+        installed = s->installedObj();
+    }
+
+    return installed;
+}
+
+TransactionRequest::TransactionRequest()
+    : type(Type::Packages)
+    , downloadOnly(false)
+    , force(false)
+    , upgrade(false)
+    , prepareOnly(false)
+    , prepared(false)
+{
+}
+
+QByteArray TransactionRequest::toJson() const
+{
+    QJsonArray intentsArray;
+    for (const QPair< QString, PackageOperation > &intent : intents) {
+        intentsArray.append(QJsonArray() << intent.first << static_cast<int>(intent.second));
+    }
+
+    QJsonObject object;
+    object.insert(QStringLiteral("type"), static_cast<int>(type));
+    object.insert(QStringLiteral("intents"), intentsArray);
+    object.insert(QStringLiteral("downloadOnly"), downloadOnly);
+    object.insert(QStringLiteral("path"), path);
+    object.insert(QStringLiteral("force"), force);
+    object.insert(QStringLiteral("upgrade"), upgrade);
+    object.insert(QStringLiteral("prepareOnly"), prepareOnly);
+    object.insert(QStringLiteral("prepared"), prepared);
+    object.insert(QStringLiteral("alias"), alias);
+    object.insert(QStringLiteral("urls"), QJsonArray::fromStringList(urls));
+
+    return QJsonDocument(object).toJson(QJsonDocument::Compact);
+}
+
+TransactionRequest TransactionRequest::fromJson(const QByteArray &json)
+{
+    QJsonObject object = QJsonDocument::fromJson(json).object();
+
+    TransactionRequest request;
+    request.type = static_cast<Type>(object.value(QStringLiteral("type")).toInt());
+    for (const QJsonValue &value : object.value(QStringLiteral("intents")).toArray()) {
+        QJsonArray intent = value.toArray();
+        request.intents.append(qMakePair(intent.at(0).toString(), static_cast<PackageOperation>(intent.at(1).toInt())));
+    }
+    request.downloadOnly = object.value(QStringLiteral("downloadOnly")).toBool();
+    request.path = object.value(QStringLiteral("path")).toString();
+    request.force = object.value(QStringLiteral("force")).toBool();
+    request.upgrade = object.value(QStringLiteral("upgrade")).toBool();
+    request.prepareOnly = object.value(QStringLiteral("prepareOnly")).toBool();
+    request.prepared = object.value(QStringLiteral("prepared")).toBool();
+    request.alias = object.value(QStringLiteral("alias")).toString();
+    for (const QJsonValue &url : object.value(QStringLiteral("urls")).toArray()) {
+        request.urls.append(url.toString());
+    }
+
+    return request;
+}
+
+TransactionRunner::TransactionRunner(zypp::ZYpp::Ptr zypp, PoolManager *pool, CallbacksManager *callbacks)
+    : m_zypp(zypp)
+    , m_pool(pool)
+    , m_callbacks(callbacks)
+    , m_preparedSerial(0)
+{
+}
+
+TransactionRunner::~TransactionRunner()
+{
+}
+
+bool TransactionRunner::run(const TransactionRequest &request, QString &errorName, QString &errorMessage, QByteArray &result)
+{
+    if (request.type == TransactionRequest::Type::Refresh) {
+        return refresh(errorName, errorMessage);
+    } else if (request.type == TransactionRequest::Type::AddRepository) {
+        return addRepository(request.alias, request.urls, errorName, errorMessage);
+    } else if (request.type == TransactionRequest::Type::RemoveRepository) {
+        return removeRepository(request.alias, errorName, errorMessage);
+    }
+
+    if (request.prepared && hasPrepared(request.path)) {
+        qDebug() << "Committing the update prepared for" << request.path;
+    } else {
+        if (request.prepared) {
+            // Slower, but still correct.
+            qWarning() << "The update prepared for" << request.path << "did not survive until its commit, preparing it again.";
+        }
+        if (!prepare(request, errorName, errorMessage)) {
+            m_preparedPath.clear();
+            return false;
+        }
+    }
+
+    if (request.prepareOnly) {
+        // Anything preparing the pool from now on, readers included, moves the serial and takes it away.
+        m_preparedPath = request.path;
+        m_preparedSerial = m_pool->stateSerial();
+        m_preparedCookie = PoolManager::rpmdbCookie();
+        return true;
+    }
+    m_preparedPath.clear();
+
+    // Create our commit policy
+    zypp::ZYppCommitPolicy policy;
+    if (request.downloadOnly) {
+        policy = policy.downloadMode(zypp::DownloadOnly);
+    }
+    policy = policy.rpmExcludeDocs(true);
+
+    int items = 0;
+    bool success = commit(request, policy, errorName, errorMessage, items);
+    result = QByteArray::number(items);
+
+    if (request.type == TransactionRequest::Type::LocalPackages) {
+        // We remove our repo, before being done with this.
+        m_pool->dropLocalRepository();
+    }
+
+    return success;
+}
+
+bool TransactionRunner::hasPrepared(const QString &path) const
+{
+    return !m_preparedPath.isEmpty() && m_preparedPath == path && m_pool->stateSerial() == m_preparedSerial &&
+           !m_preparedCookie.isEmpty() && m_preparedCookie == PoolManager::rpmdbCookie();
+}
+
+bool TransactionRunner::prepare(const TransactionRequest &request, QString &errorName, QString &errorMessage)
+{
+    if (request.type == TransactionRequest::Type::LocalPackages) {
+        if (!prepareLocalPackages(request.path, request.force, errorName, errorMessage)) {
+            return false;
+        }
+    } else {
+        m_pool->preparePool();
+
+        std::list<zypp::RepoInfo> repos = m_pool->repositories();
+        // Mark each package for planned operation. However many there are, they are resolved and committed together.
+        for (const QPair< QString, TransactionRequest::PackageOperation > &intent : request.intents) {
+            markPackage(repos, intent.first.toStdString(), intent.second);
+        }
+    }
+
+    // Set resolver options
+    if (request.type == TransactionRequest::Type::LocalPackages && request.upgrade) {
+        // Remote repositories are loaded too: upgrade from the local packages, not from everything there is.
+        m_zypp->resolver()->addUpgradeRepo(zypp::sat::Pool::instance().reposFind(TMP_RPM_REPO_ALIAS));
+    } else {
+        m_zypp->resolver()->setUpgradeMode(request.upgrade);
+    }
+
+    qDebug() << "Invoking the solver!";
+    if (!m_zypp->resolver()->resolvePool()) {
+        qWarning() << "Could not resolve the pool!";
+        m_pool->dropLocalRepository();
+        m_pool->resetPoolState();
+        errorName = QDBusError::errorString(QDBusError::InternalError);
+        errorMessage = QStringLiteral("Could not resolve the pool");
+        return false;
+    }
+
+    qDebug() << "Solver found a solution!";
+    return true;
+}
+
+bool TransactionRunner::prepareLocalPackages(const QString &path, bool force, QString &errorName, QString &errorMessage)
+{
+    QDir packagesDir(path);
+    QStringList installPackages;
+    for (const QFileInfo &package : packagesDir.entryInfoList(QStringList() << QStringLiteral("*.rpm"))) {
+        using zypp::target::rpm::RpmHeader;
+        // rpm header (need name-version-release)
+        RpmHeader::constPtr header =
+            RpmHeader::readPackage(package.absoluteFilePath().toStdString(), RpmHeader::NOSIGNATURE);
+        if (header) {
+            qDebug() << "Going to install package " << header->tag_name().c_str() << header->tag_edition().asString().c_str();
+            installPackages << QString::fromStdString(header->tag_name());
+        } else {
+            errorName = QDBusError::errorString(QDBusError::InternalError);
+            errorMessage = QStringLiteral("Contents of the package appear to be corrupted or invalid.");
+            return false;
+        }
+    }
+
+    // Build a temporary repository straight into the pool, alongside the target. It goes away with the transaction.
+    zypp::RepoInfo repo;
+    if (!m_pool->prepareLocalPool(TMP_RPM_REPO_ALIAS, path, repo)) {
+        qWarning() << "Warning: could not load temporary repository!" << path;
+        errorName = QDBusError::errorString(QDBusError::InternalError);
+        errorMessage = QStringLiteral("Could not load temporary repository");
+        return false;
+    }
+
+    // tell the solver what we want
+    std::list< zypp::RepoInfo > repos;
+    repos.insert(repos.begin(), repo);
+
+    // Mark packages for installation
+    for (const QString &package : installPackages) {
+        markPackage(repos, package.toStdString(), TransactionRequest::PackageOperation::InstallOrUpdate, force);
+    }
+    // Package removal?
+    if (QFile::exists(QStringLiteral("%1%2remove.json").arg(packagesDir.path(), QDir::separator()))) {
+        QFile removePackages(QStringLiteral("%1%2remove.json").arg(packagesDir.path(), QDir::separator()));
+        if (!removePackages.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            m_pool->dropLocalRepository();
+            m_pool->resetPoolState();
+            errorName = QDBusError::errorString(QDBusError::InternalError);
+            errorMessage = QStringLiteral("Contents of the package appear to be corrupted or invalid.");
+            return false;
+        }
+
+        QJsonObject rp = QJsonDocument::fromJson(removePackages.readAll()).object();
+
+        for (const QVariant &package : rp.value(QStringLiteral("removePackages")).toArray().toVariantList()) {
+            markPackage(repos, package.toString().toStdString(), TransactionRequest::PackageOperation::Remove, force);
+        }
+    }
+
+    return true;
+}
+
+bool TransactionRunner::markPackage(const std::list< zypp::RepoInfo > &repos, const std::string &packageName,
+                                    TransactionRequest::PackageOperation operation, bool force)
+{
+    // Straight from the index, rather than a query over the whole pool.
+    zypp::ui::Selectable::Ptr s = m_pool->packageSelectable(packageName);
+    if (!s) {
+        // Ouch.
+        return false;
+    }
+
+    // Available objects come best first. Like the pool query this replaced, take the best one from the given
+    // repositories for each architecture: a package built for more than one gets a candidate for each of them.
+    // Removals are about what is on the system, wherever it came from.
+    // FIXME this ignores vendor lock - we need some way to do --from which
+    // would respect vendor lock: e.g. a new Selectable::updateCandidateObj(Options&)
+    std::list<zypp::PoolItem> candidates;
+    std::set<std::string> arches;
+    if (operation == TransactionRequest::PackageOperation::Remove) {
+        for (zypp::ui::Selectable::installed_iterator it = s->installedBegin(); it != s->installedEnd(); ++it) {
+            if (arches.insert((*it)->arch().asString()).second) {
+                candidates.push_back(*it);
+            }
+        }
+    } else {
+        for (zypp::ui::Selectable::available_iterator it = s->availableBegin(); it != s->availableEnd(); ++it) {
+            for (std::list<zypp::RepoInfo>::const_iterator repo = repos.begin(); repo != repos.end(); ++repo) {
+                if (it->repoInfo().alias() == repo->alias()) {
+                    if (arches.insert((*it)->arch().asString()).second) {
+                        candidates.push_back(*it);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    if (candidates.empty()) {
+        // Ouch.
+        return false;
+    }
+
+    for (zypp::PoolItem candidate : candidates) {
+        bool completed = false;
+        // What are we doing?
+        switch (operation) {
+            case TransactionRequest::PackageOperation::Install:
+                if (s->hasInstalledObj()) {
+                    // Are we forcing?
+                    if (force) {
+                        // It's ok then, let's just insist.
+                        candidate.status().setToBeInstalled(zypp::ResStatus::USER);
+                        qDebug() << "A candidate is already installed, forcing the selected one to be installed";
+                        completed = true;
+                    } else {
+                        // Ouch. Move on, even though it's going to be a failure 99%
+                    }
+                } else {
+                    s->setOnSystem(candidate);
+                    qDebug() << "Marked a solvable to be on system";
+                    completed = true;
+                }
+                break;
+            case TransactionRequest::PackageOperation::Remove:
+                if (candidate.status().isInstalled()) {
+                    // Got it!
+                    candidate.status().setToBeUninstalled(zypp::ResStatus::USER);
+                    qDebug() << "Marked a package for removal";
+                    completed = true;
+                } else {
+                    // Move on...
+                }
+                break;
+            case TransactionRequest::PackageOperation::Update: {
+                    zypp::PoolItem instobj = zypp_get_installed_obj(s);
+                    if (instobj) {
+                        if (s->availableEmpty()) {
+                            // Damn.
+                            break;
+                        }
+
+                        // check vendor (since candidate selection does not do it)
+                        // FIXME: Do we need this?
+                        // bool changes_vendor = ! VendorAttr::instance().equivalent(
+                        //           instobj->vendor(), candidate->vendor());
+
+                        zypp::PoolItem best;
+                        if ((best = s->updateCandidateObj())) {
+                            zypp::ui::asSelectable()(best)->setOnSystem(best);
+                            completed = true;
+                        } else {
+                            // No match.
+                        }
+                    }
+                }
+                break;
+            case TransactionRequest::PackageOperation::InstallOrUpdate: {
+                if (s->hasInstalledObj()) {
+                    // Can we update?
+                    zypp::PoolItem instobj = zypp_get_installed_obj(s);
+                    if (instobj) {
+                        if (s->availableEmpty()) {
+                            // Are we forcing?
+                            if (force) {
+                                // It's ok then, let's just insist.
+                                candidate.status().setToBeInstalled(zypp::ResStatus::USER);
+                                qDebug() << "A candidate is already installed, forcing the selected one to be installed";
+                                completed = true;
+                            } else {
+                                // Ouch. Move on, even though it's going to be a failure 99%
+                            }
+                        }
+
+                        // check vendor (since candidate selection does not do it)
+                        // FIXME: Do we need this?
+                        // bool changes_vendor = ! VendorAttr::instance().equivalent(
+                        //           instobj->vendor(), candidate->vendor());
+
+                        zypp::PoolItem best;
+                        if ((best = s->updateCandidateObj())) {
+                            zypp::ui::asSelectable()(best)->setOnSystem(best);
+                            completed = true;
+                        } else {
+                            // No match.
+                        }
+                    }
+                } else {
+                    s->setOnSystem(candidate);
+                    qDebug() << "Marked a solvable to be on system";
+                    completed = true;
+                }
+                break;
+            }
+            default:
+                // Wat?
+                return false;
+        }
+
+        if (completed) {
+            // We're done
+            return true;
+        }
+    }
+
+    // If we got here, it didn't go that well.
+    return false;
+}
+
+bool TransactionRunner::commit(const TransactionRequest &request, const zypp::ZYppCommitPolicy &commitPolicy,
+                               QString &errorName, QString &errorMessage, int &items)
+{
+    // COMMIT
+    // TODO: Confirm licenses
+
+    try {
+        qDebug() << "committing transaction";
+
+        // Give information to our callbacks manager. This also gives more information to the transaction types.
+        items = configureCallbacks(m_zypp->resolver()->getTransaction());
+
+        zypp::ZYppCommitPolicy policy(commitPolicy);
+        if (policy.downloadMode() != zypp::DownloadOnly) {
+            // With packages downloaded as needed, rpm would be at work while we're still downloading. Get all of
+            // them in first, while a cancellation is still harmless.
+            zypp::ZYppCommitPolicy downloadPolicy(commitPolicy);
+            downloadPolicy.downloadMode(zypp::DownloadOnly);
+            // This blocks for as long as the downloads take: we're either on the executor, or in a transaction process.
+            zypp::ZYppCommitResult downloaded = m_zypp->commit(downloadPolicy);
+            if (!downloaded.noError()) {
+                errorName = QStringLiteral(DOWNLOAD_FAILED_ERROR);
+                errorMessage = QStringLiteral("Downloading packages failed.");
+                endTransaction();
+                return false;
+            }
+
+            // A download-only commit is no dry run: zypp reloaded the target after it, and whatever was marked on
+            // installed packages, removals first, is gone. Mark and resolve the request again. Everything is in
+            // the package cache by now, so it comes down to the same transaction, and no further download.
+            if (!prepare(request, errorName, errorMessage)) {
+                endTransaction();
+                return false;
+            }
+
+            policy.downloadMode(zypp::DownloadInAdvance);
+        }
+
+        bool cancelled;
+        if (policy.downloadMode() == zypp::DownloadOnly) {
+            // Nothing but downloads: cancellable all the way.
+            cancelled = m_callbacks->isAborted();
+        } else {
+            // Past this, rpm modifies the system and the transaction can't be cancelled anymore.
+            cancelled = !m_callbacks->enterPointOfNoReturn();
+        }
+
+        if (cancelled) {
+            // Nothing happened to the system yet.
+            endTransaction();
+            return false;
+        }
+
+        zypp::ZYppCommitResult result = m_zypp->commit(policy);
+
+        if (!result.noError()) {
+            errorName = QStringLiteral(COMMIT_FAILED_ERROR);
+            errorMessage = QStringLiteral("Committing the transaction failed.");
+            return false;
+        }
+
+        // TODO: Handle messages
+        //show_update_messages(zypper, result.updateMessages());
+    } catch (const zypp::media::MediaException &e) {
+        ZYPP_CAUGHT(e);
+        errorName = QStringLiteral(DOWNLOAD_FAILED_ERROR);
+        errorMessage = QString::fromStdString(e.asUserHistory());
+        return false;
+    } catch (zypp::repo::RepoException &e) {
+        ZYPP_CAUGHT(e);
+
+        bool refresh_needed = false;
+        try {
+            if (!e.info().baseUrlsEmpty()) {
+                for (zypp::RepoInfo::urls_const_iterator it = e.info().baseUrlsBegin(); it != e.info().baseUrlsEnd(); ++it) {
+                    zypp::RepoManager::RefreshCheckStatus stat = m_pool->repoManager()->checkIfToRefreshMetadata(e.info(), *it,
+                                                                                                                  zypp::RepoManager::RefreshForced);
+                    if (stat == zypp::RepoManager::REFRESH_NEEDED) {
+                        refresh_needed = true;
+                        break;
+                    }
+                }
+            }
+        } catch (const zypp::Exception &) {
+            qDebug() << "check if to refresh exception caught, ignoring" << endl;
+        }
+
+        if (refresh_needed) {
+            errorName = QStringLiteral(REFRESH_NEEDED_ERROR);
+            errorMessage = QStringLiteral("Repositories need to be refreshed first.");
+        } else {
+            errorName = QStringLiteral(REPOSITORY_ERROR);
+            errorMessage = QString::fromStdString(e.asUserHistory());
+        }
+
+        return false;
+    } catch (const zypp::FileCheckException &e) {
+        ZYPP_CAUGHT(e);
+        errorName = QStringLiteral(INTEGRITY_CHECK_FAILED_ERROR);
+        errorMessage = QString::fromStdString(e.asUserHistory());
+//                 zypper.out().error(e,
+//                     _("The package integrity check failed. This may be a problem"
+//                     " with the repository or media. Try one of the following:\n"
+//                     "\n"
+//                     "- just retry previous command\n"
+//                     "- refresh the repositories using 'zypper refresh'\n"
+//                     "- use another installation medium (if e.g. damaged)\n"
+//                     "- use another repository"));
+//                 zypper.setExitCode(ZYPPER_EXIT_ERR_ZYPP);
+        return false;
+    } catch (const zypp::Exception &e) {
+        ZYPP_CAUGHT(e);
+        errorName = QStringLiteral(COMMIT_FAILED_ERROR);
+        errorMessage = QString::fromStdString(e.asUserHistory());
+        return false;
+    }
+
+    // TODO: Handle reboot? We should only if we are updating system, regardless.
+    // TODO: Handle restart? Probably yes.
+    // TODO: Zypper is clever enough to restart affected processes. Maybe we should.
+
+    endTransaction();
+
+    return true;
+}
+
+void TransactionRunner::endTransaction()
+{
+    resetCallbacks();
+
+    // Whatever was marked for this transaction must not survive it, or the next one would inherit it.
+    m_pool->resetPoolState();
+}
+
+bool TransactionRunner::refresh(QString &errorName, QString &errorMessage)
+{
+    zypp::RepoManager *manager = m_pool->repoManager();
+    std::list<zypp::RepoInfo> repos = m_pool->repositories();
+    qDebug() << "Found " << repos.size() << " repos.";
+
+    m_callbacks->setOperationType(CallbacksManager::OperationType::Repository);
+    m_callbacks->setTotalItems(repos.size());
+
+    QString errorString = QStringLiteral("Errors: ");
+
+    unsigned repocount = 0, errcount = 0;
+    for (std::list<zypp::RepoInfo>::const_iterator it = repos.begin(); it != repos.end(); ++it, ++repocount) {
+        if (m_callbacks->isAborted()) {
+            // Whatever got refreshed so far stays: metadata is replaced atomically, repository by repository.
+            qDebug() << "Refresh cancelled after" << repocount << "repositories.";
+            return false;
+        }
+
+        zypp::Url url = it->url();
+        std::string scheme(url.getScheme());
+
+        if (scheme == "cd" || scheme == "dvd") {
+            qDebug() << "Skipping CD/DVD repository: "
+            "alias:[" << it->alias().c_str() << "] "
+            "url:[" << url.asCompleteString().c_str() << "] ";
+            m_callbacks->notifyRepositoryDone();
+            continue;
+        }
+
+        // refresh only enabled repos with enabled autorefresh (bnc #410791)
+        if (!(it->enabled() /*&& it->autorefresh()*/)) {
+            qDebug() << "Skipping disabled/no-autorefresh repository: "
+            "alias:[" << it->alias().c_str() << "] "
+            "url:[" << url.asCompleteString().c_str() << "] ";
+            m_callbacks->notifyRepositoryDone();
+            continue;
+        }
+
+        try {
+            manager->refreshMetadata(*it);
+            manager->buildCache(*it);
+        } catch (const zypp::Exception &excpt_r ) {
+            if (m_callbacks->isAborted()) {
+                qDebug() << "Refresh of" << it->name().c_str() << "aborted.";
+                return false;
+            }
+
+            qWarning() << " Error:" << endl
+            << "Could not refresh repository " << it->name().c_str() << excpt_r.asUserString().c_str() << excpt_r.historyAsString().c_str();
+            errorString.append(QString::fromStdString(excpt_r.asUserString().c_str()));
+            ++errcount;
+        }
+        m_callbacks->notifyRepositoryDone();
+    }
+
+    if (errcount) {
+        if (repocount == errcount) {
+            // the whole operation failed (all of the repos)
+            qDebug() << "The whole operation failed!";
+            errorName = QStringLiteral(REFRESH_FAILED_ERROR);
+            errorMessage = errorString;
+            return false;
+        }
+
+        if (repocount > errcount) {
+            // some of the repos failed
+            qDebug() << "Repositories successfully updated, some not";
+            qWarning() << errorString;
+        }
+    } else {
+        qDebug() << "Repositories successfully updated!";
+    }
+
+    return true;
+}
+
+int TransactionRunner::configureCallbacks(zypp::sat::Transaction transaction)
+{
+    // Iterate each step to find out the real transaction size.
+    quint64 items = 0;
+    quint64 downloadSize = 0;
+    for (zypp::sat::Transaction::const_iterator it = transaction.begin(); it != transaction.end(); ++it) {
+        zypp::sat::Transaction::Step step = *it;
+        if (step.stepType() == zypp::sat::Transaction::TRANSACTION_IGNORE) {
+            // Ignore steps are not interesting for our callbacks.
+            continue;
+        }
+
+        ++items;
+        zypp::ResObject::Ptr o(zypp::makeResObject(step.satSolvable()));
+        downloadSize += o->downloadSize();
+    }
+
+    m_callbacks->setOperationType(CallbacksManager::OperationType::Package);
+    m_callbacks->setTotalItems(items, downloadSize);
+
+    qDebug() << "Callbacks have been configured for a transaction consisting of" << items << "items, and" << downloadSize << "bytes to be downloaded.";
+    zypp::sat::dumpOn(std::cout, m_zypp->resolver()->getTransaction());
+
+    return items;
+}
+
+void TransactionRunner::resetCallbacks()
+{
+    m_callbacks->setOperationType(CallbacksManager::OperationType::NoOperation);
+    qDebug() << "Callbacks reset and idling";
+}
+
+bool TransactionRunner::addRepository(const QString &alias, const QStringList &urls, QString &errorName, QString &errorMessage)
+{
+    zypp::RepoInfo repo;
+
+    // Heuristics for determining which repository we are dealing with
+    // NOTE: Hemera uses only rpm-md repositories.
+    if (urls.size() > 1) {
+        // No doubts here.
+        repo.setType(zypp::repo::RepoType::RPMMD);
+        for (const QString &url : urls) {
+            zypp::Url zyppUrl(url.toStdString());
+            if (!zyppUrl.isValid()) {
+                errorName = QDBusError::errorString(QDBusError::InvalidArgs);
+                errorMessage = QStringLiteral("Invalid repo URL");
+                return false;
+            }
+            repo.addBaseUrl(zyppUrl);
+        }
+    } else {
+        // Inspect the URL.
+        zypp::Url url(urls.first().toStdString());
+        if (!url.isValid()) {
+            errorName = QDBusError::errorString(QDBusError::InvalidArgs);
+            errorMessage = QStringLiteral("Invalid repo URL");
+            return false;
+        }
+        if (url.schemeIsLocal()) {
+            // It's a plain dir repository
+            repo.setType(zypp::repo::RepoType::RPMPLAINDIR);
+            // empty packages path would cause unwanted removal of installed rpms
+            // in current working directory (bnc #445504)
+            // OTOH packages path == ZYPPER_RPM_CACHE_DIR (the same as repo URI)
+            // causes cp file thesamefile, which fails silently. This may be worth
+            // fixing in libzypp.
+            repo.setPackagesPath("/tmp");
+        } else {
+            // It's an md repo
+            repo.setType(zypp::repo::RepoType::RPMMD);
+        }
+
+        // Add the URL
+        repo.addBaseUrl(url);
+    }
+
+    repo.setEnabled(true);
+    repo.setAutorefresh(true);
+    repo.setAlias(alias.toStdString());
+    repo.setName(alias.toStdString());
+    // Hemera's policy is to delete package from the cache to save space.
+    repo.setKeepPackages(false);
+
+    try {
+        m_pool->repoManager()->addRepository(repo);
+    } catch (const zypp::repo::RepoAlreadyExistsException & e) {
+        // It's ok to be here
+        qWarning() << "Warning: the repo already exists";
+    /* We might, one day, care about more specialized exception handling, even if I don't think so.
+    } catch (const zypp::repo::RepoInvalidAliasException & e) {
+    } catch (const zypp::repo::RepoUnknownTypeException & e) {
+    } catch (const zypp::repo::RepoException & e) {
+    */
+    } catch (const zypp::Exception & e) {
+        errorName = QDBusError::errorString(QDBusError::InternalError);
+        errorMessage = QString::fromStdString(e.asUserHistory());
+        return false;
+    }
+
+    return true;
+}
+
+bool TransactionRunner::removeRepository(const QString &alias, QString &errorName, QString &errorMessage)
+{
+    zypp::RepoManager *manager = m_pool->repoManager();
+
+    try {
+        manager->removeRepository(manager->getRepo(alias.toStdString()));
+    } catch (const zypp::Exception & e) {
+        errorName = QDBusError::errorString(QDBusError::InternalError);
+        errorMessage = QString::fromStdString(e.asUserHistory());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,106 @@
+#ifndef ZYPPTRANSACTIONRUNNER_H
+#define ZYPPTRANSACTIONRUNNER_H
+
+#include <zypp/ZYpp.h>
+#include <zypp/RepoInfo.h>
+#include <zypp/ZYppCommitPolicy.h>
+#include <zypp/sat/Transaction.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include <list>
+#include <string>
+
+class CallbacksManager;
+class PoolManager;
+
+// A transaction modifying the system, self contained: it can be carried out on the backend's executor,
+// or handed over to the zygote as a line of JSON.
+struct TransactionRequest {
+    enum class Type : uint {
+        Refresh = 0,
+        Packages,
+        LocalPackages,
+        AddRepository,
+        RemoveRepository
+    };
+
+    enum class PackageOperation : uint {
+        Install = 0,
+        Remove,
+        Update,
+        InstallOrUpdate
+    };
+    // What to do to which package, in request order.
+    typedef QList< QPair< QString, PackageOperation > > PackageIntents;
+
+    TransactionRequest();
+
+    QByteArray toJson() const;
+    static TransactionRequest fromJson(const QByteArray &json);
+
+    Type type;
+    // Packages: resolved and committed together
+    PackageIntents intents;
+    bool downloadOnly;
+    // LocalPackages: a directory of rpms, with an optional remove.json
+    QString path;
+    bool force;
+    bool upgrade;
+    // LocalPackages: stop once resolved, and keep the outcome in the pool for the commit of the same path
+    bool prepareOnly;
+    // LocalPackages: commit what prepareOnly left in the pool, if it is still there. Prepared again otherwise.
+    bool prepared;
+    // AddRepository, RemoveRepository: urls only matter when adding
+    QString alias;
+    QStringList urls;
+};
+
+// Carries out transaction requests on a pool. Whoever owns the pool runs it, always from the same thread.
+class TransactionRunner {
+public:
+    TransactionRunner(zypp::ZYpp::Ptr zypp, PoolManager *pool, CallbacksManager *callbacks);
+    ~TransactionRunner();
+
+    // result is the number of items processed, if anything was committed.
+    bool run(const TransactionRequest &request, QString &errorName, QString &errorMessage, QByteArray &result);
+
+    // Whether the pool still holds what a prepareOnly request for path resolved.
+    bool hasPrepared(const QString &path) const;
+
+    // Marks what request asks for, and resolves it. The commit prepares the request once more after downloading:
+    // zypp reloads the target after a download-only commit, and the marks on installed packages go with it.
+    bool prepare(const TransactionRequest &request, QString &errorName, QString &errorMessage);
+
+    bool markPackage(const std::list<zypp::RepoInfo> &repos, const std::string &packageName,
+                     TransactionRequest::PackageOperation operation, bool force = false);
+    // Drops whatever the transaction left in the pool, marks and solver state alike, so that the next one starts
+    // clean. Once a commit is over, run takes care of it.
+    void endTransaction();
+
+private:
+    bool refresh(QString &errorName, QString &errorMessage);
+    bool addRepository(const QString &alias, const QStringList &urls, QString &errorName, QString &errorMessage);
+    bool removeRepository(const QString &alias, QString &errorName, QString &errorMessage);
+    bool prepareLocalPackages(const QString &path, bool force, QString &errorName, QString &errorMessage);
+    bool commit(const TransactionRequest &request, const zypp::ZYppCommitPolicy &commitPolicy,
+                QString &errorName, QString &errorMessage, int &items);
+
+    int configureCallbacks(zypp::sat::Transaction transaction);
+    void resetCallbacks();
+
+    zypp::ZYpp::Ptr m_zypp;
+    PoolManager *m_pool;
+    CallbacksManager *m_callbacks;
+
+    // What the last prepareOnly request left in the pool: its path, the pool state serial and the rpmdb it holds for
+    QString m_preparedPath;
+    quint64 m_preparedSerial;
+    QByteArray m_preparedCookie;
+};
+
+#endif // ZYPPTRANSACTIONRUNNER_H
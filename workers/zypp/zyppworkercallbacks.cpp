@@ -7,6 +7,9 @@
 #include <QtCore/QDebug>
 #include <QtCore/QElapsedTimer>
 
+#include <errno.h>
+#include <unistd.h>
+
 #define MSECS_RATE_LIMIT 300
 
 
@@ -29,12 +32,21 @@ CallbacksManager::CallbacksManager(ZyppBackend *backend)
     , m_operationStep(Hemera::SoftwareManagement::ProgressReporter::OperationStep::NoStep)
     , m_items(0)
     , m_downloadSize(0)
+    , m_reportChannel(-1)
+    , m_abortState(Running)
 {
-    // Connect all
+    // Connect all. Receivers stay connected for our whole life: whether progress goes anywhere is up to
+    // m_progressActive, which can be flipped from any thread while libzypp runs on the executor.
     m_digestReport.connect();
     m_keyRingReport.connect();
     m_mediaAuthenticationReport.connect();
     m_mediaChangeReport.connect();
+    m_downloadReport.connect();
+    m_installReceiver.connect();
+    m_mediaDownloadReport.connect();
+    m_progressReport.connect();
+    m_removeReceiver.connect();
+    m_repoReport.connect();
 
     m_rateLimiter.start();
 }
@@ -46,33 +58,56 @@ CallbacksManager::~CallbacksManager()
     m_keyRingReport.disconnect();
     m_mediaAuthenticationReport.disconnect();
     m_mediaChangeReport.disconnect();
-
-    setProgressStreamIsActive(false);
+    m_downloadReport.disconnect();
+    m_installReceiver.disconnect();
+    m_mediaDownloadReport.disconnect();
+    m_progressReport.disconnect();
+    m_removeReceiver.disconnect();
+    m_repoReport.disconnect();
 }
 
 void CallbacksManager::setProgressStreamIsActive(bool active)
 {
-    if (active && !m_progressActive) {
-        m_progressActive = true;
+    m_progressActive.storeRelease(active ? 1 : 0);
+}
 
-        // Connect all
-        m_downloadReport.connect();
-        m_installReceiver.connect();
-        m_mediaDownloadReport.connect();
-        m_progressReport.connect();
-        m_removeReceiver.connect();
-        m_repoReport.connect();
+void CallbacksManager::setReportChannel(int fd)
+{
+    m_reportChannel = fd;
+}
+
+void CallbacksManager::writeReport(const QByteArray &report)
+{
+    const char *data = report.constData();
+    qint64 left = report.size();
+    while (left > 0) {
+        ssize_t written = ::write(m_reportChannel, data, left);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // The parent is gone, nobody's listening.
+            return;
+        }
+        data += written;
+        left -= written;
     }
+}
+
+bool CallbacksManager::handleReport(const QByteArray &report)
+{
+    QList<QByteArray> args = report.split(' ');
 
-    if (!active && m_progressActive) {
-        // Disconnect all
-        m_downloadReport.disconnect();
-        m_installReceiver.disconnect();
-        m_mediaDownloadReport.disconnect();
-        m_progressReport.disconnect();
-        m_removeReceiver.disconnect();
-        m_repoReport.disconnect();
+    if (args.first() == "step" && args.size() == 2) {
+        setCurrentStep(static_cast<Hemera::SoftwareManagement::ProgressReporter::OperationStep>(args.at(1).toUInt()));
+        return true;
+    } else if (args.first() == "progress" && args.size() == 3) {
+        // Already rate limited by the child.
+        streamProgress(args.at(1).toInt(), args.at(2).toInt());
+        return true;
     }
+
+    return false;
 }
 
 void CallbacksManager::setTotalItems(quint64 items, quint64 downloadSize)
@@ -91,6 +126,66 @@ void CallbacksManager::setOperationType(CallbacksManager::OperationType type)
     m_downloadSize = 0;
 }
 
+CallbacksManager::OperationType CallbacksManager::operationType() const
+{
+    return m_operationType;
+}
+
+bool CallbacksManager::requestAbort()
+{
+    if (m_abortState.testAndSetOrdered(Running, AbortRequested)) {
+        return true;
+    }
+
+    // Asking twice is fine, asking once rpm is at work is not.
+    return m_abortState.loadAcquire() == AbortRequested;
+}
+
+bool CallbacksManager::enterPointOfNoReturn()
+{
+    if (m_reportChannel >= 0) {
+        // Forked: cancellations reach the parent first, so the parent decides.
+        writeReport("commit\n");
+        if (readAnswer() != "go") {
+            m_abortState.storeRelease(AbortRequested);
+            return false;
+        }
+    }
+
+    return m_abortState.testAndSetOrdered(Running, PointOfNoReturn);
+}
+
+void CallbacksManager::clearAbort()
+{
+    m_abortState.storeRelease(Running);
+}
+
+bool CallbacksManager::isAborted() const
+{
+    return m_abortState.loadAcquire() == AbortRequested;
+}
+
+QByteArray CallbacksManager::readAnswer()
+{
+    // Answers are short and rare: a byte at a time keeps whatever comes after in the channel.
+    QByteArray answer;
+    char c;
+    while (true) {
+        ssize_t size = ::read(m_reportChannel, &c, 1);
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            // The parent is gone: nobody to say go.
+            return QByteArray();
+        }
+        if (c == '\n') {
+            return answer;
+        }
+        answer.append(c);
+    }
+}
+
 void CallbacksManager::notifyDownloadStart(quint64 size)
 {
     if (m_operationType != OperationType::Package || m_operationType == OperationType::NoOperation) {
@@ -163,7 +258,7 @@ void CallbacksManager::notifyRepositoryDone()
 
     // Add to processed, and stream
     ++m_processed;
-    if (m_progressActive) {
+    if (m_progressActive.loadAcquire()) {
         setCurrentStep(Hemera::SoftwareManagement::ProgressReporter::OperationStep::Process);
         rateLimitAndStream((m_processed * 100) / m_items);
     }
@@ -184,9 +279,23 @@ void CallbacksManager::rateLimitAndStream(int percent, int downloadRate)
         qDebug() << "Operation progress" << percent;
     }
 
-    m_backend->m_progressPercent = percent;
-    m_backend->m_progressRate = downloadRate;
-    Q_EMIT m_backend->progressChanged();
+    if (m_reportChannel >= 0) {
+        writeReport("progress " + QByteArray::number(percent) + ' ' + QByteArray::number(downloadRate) + '\n');
+        return;
+    }
+
+    streamProgress(percent, downloadRate);
+}
+
+void CallbacksManager::streamProgress(int percent, int downloadRate)
+{
+    if (!m_progressActive.loadAcquire()) {
+        // Nobody's listening.
+        return;
+    }
+
+    // We might be on the executor: let the backend's thread take care of its properties.
+    QMetaObject::invokeMethod(m_backend, "setProgress", Qt::AutoConnection, Q_ARG(int, percent), Q_ARG(int, downloadRate));
 }
 
 void CallbacksManager::setCurrentStep(Hemera::SoftwareManagement::ProgressReporter::OperationStep step)
@@ -195,15 +304,17 @@ void CallbacksManager::setCurrentStep(Hemera::SoftwareManagement::ProgressReport
         return;
     }
 
-    m_backend->m_progressCurrentStep = static_cast<uint>(step);
-    m_operationStep = step;
-    if (m_backend->m_progressPercent != 0 || m_backend->m_progressRate != 0) {
-        m_backend->m_progressPercent = 0;
-        m_backend->m_progressRate = 0;
-        Q_EMIT m_backend->progressChanged();
+    if (m_reportChannel >= 0) {
+        m_operationStep = step;
+        writeReport("step " + QByteArray::number(static_cast<uint>(step)) + '\n');
+        return;
     }
 
-    Q_EMIT m_backend->progressCurrentStepChanged();
+    m_operationStep = step;
+    if (!m_progressActive.loadAcquire()) {
+        return;
+    }
+    QMetaObject::invokeMethod(m_backend, "setProgressCurrentStep", Qt::AutoConnection, Q_ARG(uint, static_cast<uint>(step)));
 }
 
 
@@ -225,12 +336,20 @@ zypp::media::DownloadProgressReport::Action DownloadProgressReportReceiver::prob
                                                                                     const std::string& reason)
 {
     qDebug() << Q_FUNC_INFO;
+    if (m_manager->isAborted()) {
+        // We asked for it: no retries.
+        return zypp::media::DownloadProgressReport::ABORT;
+    }
     return zypp::media::DownloadProgressReport::problem(uri, error, reason);
 }
 
 bool DownloadProgressReportReceiver::progress(int value, const zypp::Url& uri, double drate_avg, double drate_now)
 {
     m_manager->notifyDownloadProgress(value, drate_now);
+    if (m_manager->isAborted()) {
+        qDebug() << "Aborting download of" << uri.asString().c_str();
+        return false;
+    }
     return zypp::media::DownloadProgressReport::progress(value, uri, drate_avg, drate_now);
 }
 
@@ -245,12 +364,19 @@ zypp::repo::DownloadResolvableReport::Action DownloadResolvableReportReceiver::p
                                                                                        const std::string& description)
 {
     qDebug() << Q_FUNC_INFO;
+    if (m_manager->isAborted()) {
+        // We asked for it: no retries.
+        return zypp::repo::DownloadResolvableReport::ABORT;
+    }
     return zypp::repo::DownloadResolvableReport::problem(resolvable, error, description);
 }
 
 bool DownloadResolvableReportReceiver::progress(int value, zypp::Resolvable::constPtr resolvable)
 {
     qDebug() << Q_FUNC_INFO << value;
+    if (m_manager->isAborted()) {
+        return false;
+    }
     return zypp::repo::DownloadResolvableReport::progress(value, resolvable);
 }
 
@@ -368,6 +494,9 @@ zypp::repo::RepoReport::Action RepoReportReceiver::problem(zypp::Repository repo
 bool RepoReportReceiver::progress(const zypp::ProgressData& data)
 {
     m_manager->notifyOperationProgress(data.reportValue());
+    if (m_manager->isAborted()) {
+        return false;
+    }
     return zypp::repo::RepoReport::progress(data);
 }
 
@@ -8,6 +8,8 @@
 
 #include <zypp/sat/Queue.h>
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArray>
 #include <QtCore/QElapsedTimer>
 
 #include <HemeraSoftwareManagement/ProgressReporter>
@@ -15,7 +17,7 @@
 #include <iostream>
 
 class ZyppBackend;
-class ZyppRefreshRepositoriesOperation;
+class TransactionRunner;
 class CallbacksManager;
 
 static bool readCallbackAnswer() { return false; }
@@ -192,9 +194,33 @@ public:
 
     void setCurrentStep(Hemera::SoftwareManagement::ProgressReporter::OperationStep step);
     void setOperationType(OperationType type);
+    OperationType operationType() const;
     void setTotalItems(quint64 items, quint64 downloadSize = 0);
 
+    // Cancellation. Downloads give up at their next callback, the rpm transaction is never interrupted:
+    // a cancellation and the start of the rpm transaction race for the same flag, and only one of them gets it.
+    // requestAbort fails once the rpm transaction started, enterPointOfNoReturn fails if a cancellation got
+    // there first. Safe to call from any thread, and requestAbort from a signal handler as well.
+    bool requestAbort();
+    bool enterPointOfNoReturn();
+    void clearAbort();
+    bool isAborted() const;
+
+    // Zygote mode. In a forked transaction, progress is written to the channel instead of the backend,
+    // and the parent feeds it back through handleReport.
+    void setReportChannel(int fd);
+    void writeReport(const QByteArray &report);
+    bool handleReport(const QByteArray &report);
+
 private:
+    enum AbortState {
+        Running = 0,
+        AbortRequested = 1,
+        PointOfNoReturn = 2
+    };
+
+    QByteArray readAnswer();
+
     // Proxied callback functions, for convenience
     void notifyDownloadStart(quint64 size);
     void notifyDownloadProgress(int percent, int rate);
@@ -220,7 +246,7 @@ private:
 
     ZyppBackend *m_backend;
 
-    bool m_progressActive;
+    QAtomicInt m_progressActive;
 
     OperationType m_operationType;
     Hemera::SoftwareManagement::ProgressReporter::OperationStep m_operationStep;
@@ -233,7 +259,11 @@ private:
 
     QElapsedTimer m_rateLimiter;
 
+    int m_reportChannel;
+    QAtomicInt m_abortState;
+
     void rateLimitAndStream(int percent, int downloadRate = 0);
+    void streamProgress(int percent, int downloadRate);
 
     // All of our friends.
     friend struct MediaChangeReportReceiver;
@@ -247,7 +277,7 @@ private:
     friend struct KeyRingReceive;
     friend struct DigestReceive;
 
-    friend class ZyppRefreshRepositoriesOperation;
+    friend class TransactionRunner;
 };
 
 
@@ -0,0 +1,255 @@
+#include "zyppzygote.h"
+
+#include "zyppworkercallbacks.h"
+#include "zypppoolmanager.h"
+#include "zypptransactionrunner.h"
+
+#include <zypp/ZYppFactory.h>
+
+#include <QtCore/QDebug>
+
+#include <QtDBus/QDBusError>
+
+#include <HemeraCore/Literals>
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static CallbacksManager *s_abortCallbacks = nullptr;
+static int s_channel = -1;
+
+static void abortSignalHandler(int)
+{
+    s_abortCallbacks->requestAbort();
+}
+
+int ZyppZygote::spawn()
+{
+    // zypp's lock is taken here, once for the worker and the zygote: the worker's getZYpp finds it in place.
+    zypp::ZYpp::Ptr zypp;
+    try {
+        zypp = zypp::getZYpp();
+    } catch (const zypp::Exception &excpt_r) {
+        ZYPP_CAUGHT (excpt_r);
+        qWarning() << "Could not initialize Zypp for the zygote:" << excpt_r.asUserString().c_str();
+        return -1;
+    }
+
+    int channel[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channel)) {
+        qWarning() << "Could not create the zygote channel.";
+        return -1;
+    }
+
+    // Cancellations reach transaction processes through SIGUSR1. The zygote keeps it blocked, each transaction
+    // unblocks it once its handler is in place: nothing sent in between gets lost.
+    sigset_t abortSignal;
+    sigset_t previousMask;
+    ::sigemptyset(&abortSignal);
+    ::sigaddset(&abortSignal, SIGUSR1);
+    ::sigprocmask(SIG_BLOCK, &abortSignal, &previousMask);
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        ::close(channel[0]);
+        ZyppZygote zygote(zypp, channel[1]);
+        zygote.run();
+        // Never reached
+    }
+
+    ::sigprocmask(SIG_SETMASK, &previousMask, nullptr);
+    ::close(channel[1]);
+
+    if (pid < 0) {
+        qWarning() << "Could not fork the zygote.";
+        ::close(channel[0]);
+        return -1;
+    }
+
+    qDebug() << "Zygote forked into process" << pid;
+    s_channel = channel[0];
+    return s_channel;
+}
+
+int ZyppZygote::channel()
+{
+    return s_channel;
+}
+
+void ZyppZygote::lost()
+{
+    if (s_channel < 0) {
+        return;
+    }
+
+    ::close(s_channel);
+    s_channel = -1;
+}
+
+bool ZyppZygote::runsInZygote(const TransactionRequest &request)
+{
+    // Nothing happens to the system, or the pool: no need for a process of their own.
+    return request.prepareOnly ||
+           request.type == TransactionRequest::Type::AddRepository ||
+           request.type == TransactionRequest::Type::RemoveRepository;
+}
+
+ZyppZygote::ZyppZygote(zypp::ZYpp::Ptr zypp, int channel)
+    : m_zypp(zypp)
+    , m_channel(channel)
+    , m_callbacks(new CallbacksManager(nullptr))
+    , m_pool(nullptr)
+    , m_runner(nullptr)
+{
+    // Nobody but the worker listens to us: progress always goes through the channel.
+    m_callbacks->setReportChannel(m_channel);
+    m_callbacks->setProgressStreamIsActive(true);
+}
+
+void ZyppZygote::run()
+{
+    // Reloads are the worker's business. As for stopping, we go away with the channel.
+    ::signal(SIGHUP, SIG_IGN);
+
+    QByteArray request;
+    while (readRequest(request)) {
+        serve(TransactionRequest::fromJson(request));
+    }
+
+    // Don't run any destructor: they are the worker's.
+    ::_exit(0);
+}
+
+bool ZyppZygote::readRequest(QByteArray &request)
+{
+    // A byte at a time: what comes after the request is for the transaction process to read.
+    request.clear();
+    char c;
+    while (true) {
+        ssize_t size = ::read(m_channel, &c, 1);
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            // The worker is gone.
+            return false;
+        }
+        if (c == '\n') {
+            return true;
+        }
+        request.append(c);
+    }
+}
+
+void ZyppZygote::serve(const TransactionRequest &request)
+{
+    QString errorName;
+    QString errorMessage;
+    QByteArray result;
+
+    m_callbacks->clearAbort();
+
+    if (!ensureInitialized(errorName, errorMessage)) {
+        reportOutcome(false, errorName, errorMessage, result);
+        m_callbacks->writeReport("exit 0\n");
+        return;
+    }
+
+    // Someone else may have touched the repository configuration: pick up whatever changed since last time.
+    m_pool->reloadRepositories();
+
+    if (runsInZygote(request)) {
+        // Right here: a prepareOnly request leaves our pool with what the commit needs.
+        bool success = m_runner->run(request, errorName, errorMessage, result);
+        reportOutcome(success, errorName, errorMessage, result);
+        m_callbacks->writeReport("exit 0\n");
+        return;
+    }
+
+    if (request.type == TransactionRequest::Type::Packages) {
+        // Load the repositories here rather than in the transaction process, so that the next one finds them in place.
+        try {
+            m_pool->preparePool();
+        } catch (const zypp::Exception &excpt_r) {
+            ZYPP_CAUGHT (excpt_r);
+            qWarning() << "Could not prepare the pool, leaving it to the transaction:" << excpt_r.asUserString().c_str();
+        }
+    }
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        runTransaction(request);
+        // Never reached
+    }
+
+    if (pid < 0) {
+        reportOutcome(false, Hemera::Literals::literal(Hemera::Literals::Errors::failedRequest()),
+                      QStringLiteral("Could not fork the transaction process."), result);
+        m_callbacks->writeReport("exit 0\n");
+        return;
+    }
+
+    // The worker needs it to cancel the transaction.
+    m_callbacks->writeReport("pid " + QByteArray::number(pid) + '\n');
+
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+
+    // Whatever the transaction did to the system, our pool catches up with it on its next preparation.
+    m_callbacks->writeReport("exit " + QByteArray::number(status) + '\n');
+}
+
+void ZyppZygote::runTransaction(const TransactionRequest &request)
+{
+    s_abortCallbacks = m_callbacks;
+    ::signal(SIGUSR1, abortSignalHandler);
+    sigset_t abortSignal;
+    ::sigemptyset(&abortSignal);
+    ::sigaddset(&abortSignal, SIGUSR1);
+    ::sigprocmask(SIG_UNBLOCK, &abortSignal, nullptr);
+
+    QString errorName;
+    QString errorMessage;
+    QByteArray result;
+    bool success = m_runner->run(request, errorName, errorMessage, result);
+    reportOutcome(success, errorName, errorMessage, result);
+
+    // Don't run any destructor: the pool and zypp's lock belong to the zygote.
+    ::_exit(success ? 0 : 1);
+}
+
+bool ZyppZygote::ensureInitialized(QString &errorName, QString &errorMessage)
+{
+    if (m_runner) {
+        return true;
+    }
+
+    try {
+        m_zypp->initializeTarget("/");
+    } catch (const zypp::Exception &excpt_r) {
+        ZYPP_CAUGHT (excpt_r);
+        errorName = QDBusError::errorString(QDBusError::InternalError);
+        errorMessage = QString::fromStdString(excpt_r.asUserHistory());
+        return false;
+    }
+
+    // A pool of our own, resident from now on. The worker's snapshot saves us reading the rpmdb, if it still holds.
+    m_pool = new PoolManager(m_zypp);
+    m_pool->initialize();
+    m_runner = new TransactionRunner(m_zypp, m_pool, m_callbacks);
+
+    return true;
+}
+
+void ZyppZygote::reportOutcome(bool success, const QString &errorName, const QString &errorMessage, const QByteArray &result)
+{
+    if (success) {
+        m_callbacks->writeReport("done " + result.toPercentEncoding() + '\n');
+    } else {
+        m_callbacks->writeReport("error " + errorName.toUtf8().toPercentEncoding() + ' ' + errorMessage.toUtf8().toPercentEncoding() + '\n');
+    }
+}
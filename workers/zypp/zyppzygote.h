@@ -0,0 +1,50 @@
+#ifndef ZYPPZYGOTE_H
+#define ZYPPZYGOTE_H
+
+#include <zypp/ZYpp.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+class CallbacksManager;
+class PoolManager;
+class TransactionRunner;
+struct TransactionRequest;
+
+// Zygote mode. The zygote is forked from the worker at startup, before any thread exists, and stays single
+// threaded for its whole life: it is the one process that can fork safely. It runs every transaction modifying
+// the system in a process of its own, so whatever a transaction does to the pool and to libzypp dies with it.
+//
+// It talks to the worker over one channel, a line at a time:
+//   worker -> zygote: a TransactionRequest as JSON, then go or abort when the transaction asks to commit
+//   zygote -> worker: pid, step, progress, commit, done or error, and exit with the transaction's wait status
+class ZyppZygote {
+public:
+    // Returns the worker's end of the channel, or -1 if the zygote could not be started.
+    static int spawn();
+    // The worker's end of the channel, for the whole process: -1 until spawned, and once lost.
+    static int channel();
+    // The zygote went away. It can't be forked again once the worker has threads: the channel is closed for good.
+    static void lost();
+    // Whether the zygote runs request itself rather than forking a transaction process for it.
+    static bool runsInZygote(const TransactionRequest &request);
+
+private:
+    ZyppZygote(zypp::ZYpp::Ptr zypp, int channel);
+
+    void run();
+    bool readRequest(QByteArray &request);
+    void serve(const TransactionRequest &request);
+    void runTransaction(const TransactionRequest &request);
+    bool ensureInitialized(QString &errorName, QString &errorMessage);
+    void reportOutcome(bool success, const QString &errorName, const QString &errorMessage, const QByteArray &result);
+
+    zypp::ZYpp::Ptr m_zypp;
+    int m_channel;
+    CallbacksManager *m_callbacks;
+    // Set up on the first request, kept from then on
+    PoolManager *m_pool;
+    TransactionRunner *m_runner;
+};
+
+#endif // ZYPPZYGOTE_H